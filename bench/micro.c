@@ -0,0 +1,800 @@
+/*
+ * Compile and run me with:
+ *   $ cc micro.c -O2 -o micro
+ *   $ ./micro
+ *
+ * Every benchmark is warmed up and then sampled --runs times, the percentiles are over the
+ * samples divided by the operations in each. Pass --perf for hardware counters and --filter to
+ * only run some benchmarks, like --filter cache/get
+ *
+ */
+
+#include <time.h> /* clock_gettime, CLOCK_MONOTONIC */
+
+#ifdef __linux__
+#	include <sys/ioctl.h>         /* ioctl */
+#	include <sys/syscall.h>       /* syscall, SYS_perf_event_open */
+#	include <linux/perf_event.h> /* perf_event_attr, PERF_* */
+#endif
+
+/* build() is not benchmarked here, but it needs the flags to be defined */
+#define CARGS "-O2"
+
+#define CBUILDER_IMPLEMENTATION
+#include "../cbuilder.h"
+
+#define BENCH_DIR "bench-tmp"
+
+static size_t size_mb  = 256;
+static size_t runs     = 10;
+static size_t warmup   = 1;
+static bool   use_perf = false;
+static char  *filter   = NULL;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* A group like "cache" is selected by the filter "cache/get", and a benchmark like "cache/get/1k"
+   by the filter "cache" */
+static bool selected(const char *name) {
+	if (filter == NULL)
+		return true;
+
+	size_t len = strlen(name) < strlen(filter)? strlen(name) : strlen(filter);
+	return strncmp(name, filter, len) == 0;
+}
+
+#define PERF_EVENTS_COUNT 4
+
+static const char *perf_names[PERF_EVENTS_COUNT] = {
+	"cycles", "instructions", "cache-misses", "branch-misses",
+};
+
+static int perf_fds[PERF_EVENTS_COUNT];
+
+/* Counts user space events of this process and the threads and processes it starts */
+static bool perf_open(void) {
+#ifdef __linux__
+	static const uint64_t configs[PERF_EVENTS_COUNT] = {
+		PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES,
+	};
+
+	for (size_t i = 0; i < PERF_EVENTS_COUNT; ++ i) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size           = sizeof(attr);
+		attr.type           = PERF_TYPE_HARDWARE;
+		attr.config         = configs[i];
+		attr.disabled       = 1;
+		attr.inherit        = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv     = 1;
+
+		perf_fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		if (perf_fds[i] < 0) {
+			while (i --> 0)
+				close(perf_fds[i]);
+
+			return false;
+		}
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+static void perf_close(void) {
+	for (size_t i = 0; i < PERF_EVENTS_COUNT; ++ i)
+		close(perf_fds[i]);
+}
+
+static void perf_start(void) {
+#ifdef __linux__
+	for (size_t i = 0; i < PERF_EVENTS_COUNT; ++ i) {
+		ioctl(perf_fds[i], PERF_EVENT_IOC_RESET,  0);
+		ioctl(perf_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+#endif
+}
+
+static void perf_stop(uint64_t *counts) {
+#ifdef __linux__
+	for (size_t i = 0; i < PERF_EVENTS_COUNT; ++ i) {
+		ioctl(perf_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+		uint64_t count;
+		if (read(perf_fds[i], &count, sizeof(count)) == sizeof(count))
+			counts[i] += count;
+	}
+#else
+	(void)counts;
+#endif
+}
+
+static void print_time(double secs) {
+	if (secs < 1e-6)
+		printf(" %8.1f ns", secs * 1e9);
+	else if (secs < 1e-3)
+		printf(" %8.2f us", secs * 1e6);
+	else
+		printf(" %8.2f ms", secs * 1e3);
+}
+
+static int double_cmp(const void *a, const void *b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+typedef void (*bench_fn_t)(void *data);
+
+/* Runs fn warmup times, then runs times while timing it. Each call does ops operations on bytes
+   bytes in total, the report is per operation */
+static void measure(const char *name, bench_fn_t fn, void *data, size_t ops, size_t bytes) {
+	if (!selected(name))
+		return;
+
+	for (size_t r = 0; r < warmup; ++ r)
+		fn(data);
+
+	double  *secs = (double*)malloc(runs * sizeof(*secs));
+	uint64_t counts[PERF_EVENTS_COUNT] = {0};
+	if (secs == NULL)
+		LOG_FAIL("malloc()");
+
+	for (size_t r = 0; r < runs; ++ r) {
+		if (use_perf)
+			perf_start();
+
+		double start = now();
+		fn(data);
+		secs[r] = (now() - start) / (double)ops;
+
+		if (use_perf)
+			perf_stop(counts);
+	}
+
+	qsort(secs, runs, sizeof(*secs), double_cmp);
+
+	/* Nearest rank, so the p99 of few samples is the slowest one */
+	static const double percentiles[] = {50, 90, 99};
+
+	printf("%-28s", name);
+	for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); ++ i) {
+		size_t rank = (size_t)(percentiles[i] / 100 * (double)runs + 0.999999);
+		printf(" p%.0f", percentiles[i]);
+		print_time(secs[rank > 0? rank - 1 : 0]);
+	}
+
+	double median = secs[runs / 2];
+	if (bytes > 0)
+		printf(" %10.1f MB/s", (double)bytes / (double)ops / 1e6 / median);
+	else if (ops > 1)
+		printf(" %10.0f ops/s", 1 / median);
+
+	printf("\n");
+
+	if (use_perf) {
+		printf("%-28s", "");
+		for (size_t i = 0; i < PERF_EVENTS_COUNT; ++ i)
+			printf(" %.1f %s", (double)counts[i] / (double)(ops * runs), perf_names[i]);
+
+		printf(" per op\n");
+	}
+
+	free(secs);
+}
+
+static void create_file(const char *path, size_t size) {
+	FILE *f = fopen(path, "wb");
+	if (f == NULL)
+		LOG_FATAL("Failed to create '%s'", path);
+
+	/* Pseudo-random data, so no file system can cheat with sparse or deduplicated blocks */
+	static unsigned char buf[64 * 1024];
+	uint32_t state = 0x12345678;
+	for (size_t written = 0; written < size; written += sizeof(buf)) {
+		for (size_t i = 0; i < sizeof(buf); ++ i) {
+			state = state * 1664525 + 1013904223;
+			buf[i] = (unsigned char)(state >> 24);
+		}
+
+		size_t n = size - written < sizeof(buf)? size - written : sizeof(buf);
+		if (fwrite(buf, 1, n, f) != n)
+			LOG_FATAL("Failed to write '%s'", path);
+	}
+
+	fclose(f);
+}
+
+/* Copy a file with only one of the fs_copy_file() methods */
+static int copy_with(int (*method)(int, int), const char *path, const char *new_) {
+	fs_remove_file(new_);
+
+	int from = open(path, O_RDONLY);
+	int to   = open(new_, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (from < 0 || to < 0)
+		LOG_FAIL("open()");
+
+	int done = method(from, to);
+
+	close(from);
+	close(to);
+	return done;
+}
+
+typedef struct {
+	int (*method)(int, int);
+	const char *src, *dst;
+} copy_case_t;
+
+static void copy_run(void *data) {
+	copy_case_t *c = (copy_case_t*)data;
+	if (c->method == NULL) {
+		if (fs_copy_file(c->src, c->dst) != 0)
+			LOG_FATAL("fs_copy_file() failed");
+	} else if (copy_with(c->method, c->src, c->dst) <= 0)
+		LOG_FATAL("Copying '%s' failed", c->src);
+}
+
+static void bench_copy(void) {
+	if (!selected("copy"))
+		return;
+
+	const char *src = BENCH_DIR"/copy-src";
+	const char *dst = BENCH_DIR"/copy-dst";
+	size_t      size = size_mb * 1024 * 1024;
+
+	create_file(src, size);
+
+	struct {
+		const char *name;
+		int (*method)(int, int);
+	} methods[] = {
+		{"copy/reflink",         fs_copy_clone},
+		{"copy/copy_file_range", fs_copy_range},
+		{"copy/sendfile",        fs_copy_sendfile},
+		{"copy/buffered",        fs_copy_buffered},
+		{"copy/fs_copy_file",    NULL},
+	};
+
+	for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); ++ i) {
+		if (methods[i].method != NULL && selected(methods[i].name)) {
+			int done = copy_with(methods[i].method, src, dst);
+			if (done == 0) {
+				printf("%-28s unsupported\n", methods[i].name);
+				continue;
+			} else if (done < 0)
+				LOG_FATAL("'%s' failed", methods[i].name);
+		}
+
+		copy_case_t c = {methods[i].method, src, dst};
+		measure(methods[i].name, copy_run, &c, 1, size);
+	}
+
+	fs_remove_file(src);
+	fs_remove_file(dst);
+}
+
+/* The embed encoders as they were before, kept to compare against */
+static void legacy_embed_str_arr(FILE *f, FILE *o) {
+	fprintf(o, "static const char *EMBED_NAME[] = {\n\t\"");
+
+	int ch;
+	while ((ch = fgetc(f)) != EOF) {
+		switch (ch) {
+		case '\t': fprintf(o, "\\t");  break;
+		case '\r': fprintf(o, "\\r");  break;
+		case '\v': fprintf(o, "\\v");  break;
+		case '\f': fprintf(o, "\\f");  break;
+		case '\b': fprintf(o, "\\b");  break;
+		case '\0': fprintf(o, "\\0");  break;
+		case '"':  fprintf(o, "\\\""); break;
+		case '\\': fprintf(o, "\\\\"); break;
+
+		case '\n': {
+			int next = fgetc(f);
+			if (next != EOF)
+				fprintf(o, "\",\n\t\"");
+
+			ungetc(next, f);
+		} break;
+
+		default:
+			if (ch >= ' ' && ch <= '~')
+				fprintf(o, "%c", (char)ch);
+			else
+				fprintf(o, "\\x%02X", ch);
+		}
+	}
+
+	fprintf(o, "\",\n};\n#undef EMBED_NAME\n");
+}
+
+static void legacy_embed_bytes(FILE *f, FILE *o) {
+	fprintf(o, "static unsigned char EMBED_NAME[] = {\n");
+
+	int byte;
+	for (size_t i = 0; (byte = fgetc(f)) != EOF; ++ i) {
+		if (i % 10 == 0) {
+			if (i > 0)
+				fprintf(o, "\n");
+
+			fprintf(o, "\t");
+		}
+
+		fprintf(o, "0x%02X, ", byte);
+	}
+
+	fprintf(o, "\n};\n#undef EMBED_NAME\n");
+}
+
+static void legacy_embed(const char *path, const char *out, int type) {
+	FILE *f = fopen(path, "r");
+	FILE *o = fopen(out, "w");
+	if (f == NULL || o == NULL)
+		LOG_FAIL("fopen()");
+
+	fprintf(o, "/* %s */\n", path);
+
+	if (type == STRING_ARRAY)
+		legacy_embed_str_arr(f, o);
+	else
+		legacy_embed_bytes(f, o);
+
+	fclose(o);
+	fclose(f);
+}
+
+static void create_text_file(const char *path, size_t size) {
+	FILE *f = fopen(path, "w");
+	if (f == NULL)
+		LOG_FATAL("Failed to create '%s'", path);
+
+	static const char line[] = "\tThe quick brown fox jumps over the \"lazy\" dog\\n\n";
+	for (size_t written = 0; written < size; written += sizeof(line) - 1)
+		fputs(line, f);
+
+	fclose(f);
+}
+
+
+/* embed() skips outputs that are up to date, so the current encoders are run directly */
+static void current_embed(const char *path, const char *out, int type) {
+	if (!embed_generate(path, out, type, 0))
+		LOG_FATAL("Failed to embed '%s'", path);
+}
+
+typedef struct {
+	const char *name, *path, *out;
+	int         type;
+	void (*embed)(const char*, const char*, int);
+} embed_case_t;
+
+static void embed_run(void *data) {
+	embed_case_t *c = (embed_case_t*)data;
+	c->embed(c->path, c->out, c->type);
+}
+
+static void bench_embed(void) {
+	if (!selected("embed"))
+		return;
+
+	const char *bin  = BENCH_DIR"/embed.bin";
+	const char *text = BENCH_DIR"/embed.txt";
+	const char *out  = BENCH_DIR"/embed.h";
+
+	/* The old encoders are slow enough that a fraction of the size is plenty */
+	size_t size = size_mb * 1024 * 1024 / 8;
+
+	create_file(bin, size);
+	create_text_file(text, size);
+
+	embed_case_t cases[] = {
+		{"embed/bytes",         bin,  out, BYTE_ARRAY,   current_embed},
+		{"embed/bytes-legacy",  bin,  out, BYTE_ARRAY,   legacy_embed},
+		{"embed/string",        text, out, STRING_ARRAY, current_embed},
+		{"embed/string-legacy", text, out, STRING_ARRAY, legacy_embed},
+		{"embed/literal",       bin,  out, BYTE_STRING,  current_embed},
+	};
+
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++ i)
+		measure(cases[i].name, embed_run, &cases[i], 1, size);
+
+	fs_remove_file(bin);
+	fs_remove_file(text);
+	fs_remove_file(out);
+}
+
+typedef struct {
+	fs_map_t       m;
+	unsigned char *packed, *out;
+	size_t         packed_size;
+} compress_case_t;
+
+static void compress_run(void *data) {
+	compress_case_t *c = (compress_case_t*)data;
+
+	/* The compressor checks the round trip, which is included in its time */
+	unsigned char *packed;
+	embed_compress((const unsigned char*)c->m.data, c->m.size, &packed);
+	free(packed);
+}
+
+static void decompress_run(void *data) {
+	compress_case_t *c = (compress_case_t*)data;
+	if (embed_unpack(c->packed, c->packed_size, c->out, c->m.size) != (long)c->m.size)
+		LOG_FATAL("embed_unpack() failed");
+}
+
+static void bench_compress(void) {
+	if (!selected("compress") && !selected("decompress"))
+		return;
+
+	const char *bin  = BENCH_DIR"/compress.bin";
+	const char *text = BENCH_DIR"/compress.txt";
+	size_t      size = size_mb * 1024 * 1024 / 4;
+
+	create_file(bin, size);
+	create_text_file(text, size);
+
+	const char *paths[] = {text, bin};
+	const char *names[][2] = {
+		{"compress/text",   "decompress/text"},
+		{"compress/random", "decompress/random"},
+	};
+
+	for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); ++ i) {
+		compress_case_t c;
+		if (fs_map_file(&c.m, paths[i]) != 0)
+			LOG_FATAL("Failed to map '%s'", paths[i]);
+
+		c.out         = (unsigned char*)malloc(c.m.size);
+		c.packed_size = embed_compress((const unsigned char*)c.m.data, c.m.size, &c.packed);
+		if (c.out == NULL)
+			LOG_FAIL("malloc()");
+
+		if (selected(names[i][0]))
+			printf("%-28s ratio %.3f\n", names[i][0], (double)c.packed_size / (double)c.m.size);
+
+		measure(names[i][0], compress_run,   &c, 1, c.m.size);
+		measure(names[i][1], decompress_run, &c, 1, c.m.size);
+
+		free(c.packed);
+		free(c.out);
+		fs_unmap_file(&c.m);
+	}
+
+	fs_remove_file(bin);
+	fs_remove_file(text);
+}
+
+#define BENCH_LOG_THREADS 8
+#define BENCH_LOG_LINES   100000
+
+static void *log_lines(void *data) {
+	(void)data;
+	for (size_t i = 0; i < BENCH_LOG_LINES; ++ i)
+		LOG_CUSTOM("CMD", "cc -c src/file%zu.c -o bin/file%zu.o -O2 -Wall -Wextra", i, i);
+
+	return NULL;
+}
+
+/* Includes draining what the async writer still has queued when the threads are done */
+static void log_run(void *data) {
+	bool async = *(bool*)data;
+	if (async && log_async_start() != 0)
+		LOG_FATAL("log_async_start() failed");
+
+	pthread_t threads[BENCH_LOG_THREADS];
+	for (size_t i = 0; i < BENCH_LOG_THREADS; ++ i)
+		pthread_create(&threads[i], NULL, log_lines, NULL);
+
+	for (size_t i = 0; i < BENCH_LOG_THREADS; ++ i)
+		pthread_join(threads[i], NULL);
+
+	log_async_stop();
+}
+
+static void bench_log(void) {
+	if (!selected("log"))
+		return;
+
+	FILE *null = fopen("/dev/null", "w");
+	if (null == NULL)
+		LOG_FAIL("fopen()");
+
+	log_into(null);
+
+	bool sync = false, async = true;
+	measure("log/sync",  log_run, &sync,  BENCH_LOG_THREADS * BENCH_LOG_LINES, 0);
+	measure("log/async", log_run, &async, BENCH_LOG_THREADS * BENCH_LOG_LINES, 0);
+
+	log_into(stderr);
+	fclose(null);
+}
+
+#define BENCH_CACHE_OPS 1000
+
+typedef struct {
+	build_cache_t c;
+	char        **paths;
+	size_t        count;
+} cache_case_t;
+
+static void cache_save_run(void *data) {
+	cache_case_t *c = (cache_case_t*)data;
+
+	/* Unchanged caches are not written at all, and unchanged entries are taken from disk */
+	for (size_t i = 0; i < c->c.count; ++ i)
+		c->c.buf[i].dirty = true;
+
+	c->c.dirty = true;
+	if (build_cache_save(&c->c) != 0)
+		LOG_FATAL("Failed to save build cache");
+}
+
+static void cache_load_run(void *data) {
+	(void)data;
+
+	build_cache_t c;
+	if (build_cache_load(&c) != 0)
+		LOG_FATAL("Build cache is corrupted");
+
+	build_cache_free(&c);
+}
+
+/* Spread over the whole cache, so the lookups do not only hit the start of it */
+static const char *cache_path(cache_case_t *c, size_t i) {
+	return c->paths[(i * 7919) % c->count];
+}
+
+static void cache_get_run(void *data) {
+	cache_case_t *c = (cache_case_t*)data;
+	for (size_t i = 0; i < BENCH_CACHE_OPS; ++ i) {
+		if (build_cache_get(&c->c, cache_path(c, i)) < 0)
+			LOG_FATAL("Missing build cache entry");
+	}
+}
+
+static void cache_set_run(void *data) {
+	cache_case_t *c = (cache_case_t*)data;
+	for (size_t i = 0; i < BENCH_CACHE_OPS; ++ i)
+		build_cache_set(&c->c, cache_path(c, i), (int64_t)i);
+}
+
+static void bench_cache(void) {
+	if (!selected("cache"))
+		return;
+
+	/* The cache is always in the working directory */
+	if (chdir(BENCH_DIR) != 0)
+		LOG_FAIL("chdir()");
+
+	const size_t counts[] = {1000, 10000, 100000};
+	const char  *names[]  = {"1k", "10k", "100k"};
+
+	for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); ++ i) {
+		/* Start from an empty cache, the one of the previous size would be merged in */
+		build_cache_delete();
+
+		cache_case_t c;
+		c.count = counts[i];
+		c.paths = (char**)malloc(c.count * sizeof(*c.paths));
+		if (c.paths == NULL)
+			LOG_FAIL("malloc()");
+
+		if (build_cache_load(&c.c) != 0)
+			LOG_FATAL("Build cache is corrupted");
+
+		/* Filled directly, setting one entry at a time is what is being measured */
+		for (size_t j = 0; j < c.count; ++ j) {
+			char path[64];
+			snprintf(path, sizeof(path), "src/module%zu/file%zu.c", j / 64, j);
+
+			build_cache_item_t *item = build_cache_add(&c.c);
+			item->path  = FS_JOIN_PATH(path);
+			item->mtime = 1700000000 + (int64_t)j;
+			item->dirty = true;
+			c.paths[j]  = item->path;
+			if (item->path == NULL)
+				LOG_FAIL("malloc()");
+		}
+
+		char name[64];
+		cache_save_run(&c);
+		fs_map_t m;
+		if (fs_map_file(&m, BUILD_CACHE_PATH) != 0)
+			LOG_FAIL("fs_map_file()");
+
+		size_t size = m.size;
+		fs_unmap_file(&m);
+
+		snprintf(name, sizeof(name), "cache/save/%s", names[i]);
+		measure(name, cache_save_run, &c, 1, size);
+
+		snprintf(name, sizeof(name), "cache/load/%s", names[i]);
+		measure(name, cache_load_run, &c, 1, size);
+
+		snprintf(name, sizeof(name), "cache/get/%s", names[i]);
+		measure(name, cache_get_run, &c, BENCH_CACHE_OPS, 0);
+
+		snprintf(name, sizeof(name), "cache/set/%s", names[i]);
+		measure(name, cache_set_run, &c, BENCH_CACHE_OPS, 0);
+
+		build_cache_free(&c.c);
+		free(c.paths);
+	}
+
+	build_cache_delete();
+	if (chdir("..") != 0)
+		LOG_FAIL("chdir()");
+}
+
+#define BENCH_DIR_FILES 10000
+
+static void dir_run(void *data) {
+	fs_dir_t d;
+	if (fs_dir_open(&d, (const char*)data) != 0)
+		LOG_FATAL("Failed to open directory '%s'", (const char*)data);
+
+	size_t   count = 0;
+	fs_ent_t e;
+	while (fs_dir_next(&d, &e) == 0)
+		count += !(e.attr & FS_HIDDEN);
+
+	fs_dir_close(&d);
+	if (count != BENCH_DIR_FILES)
+		LOG_FATAL("Found %zu files instead of %i", count, BENCH_DIR_FILES);
+}
+
+static void bench_dir(void) {
+	if (!selected("dir"))
+		return;
+
+	const char *dir = BENCH_DIR"/dir";
+	if (fs_create_dir(dir) != 0)
+		LOG_FATAL("Failed to create directory '%s'", dir);
+
+	char path[64];
+	for (size_t i = 0; i < BENCH_DIR_FILES; ++ i) {
+		snprintf(path, sizeof(path), "%s/file%zu.c", dir, i);
+		create_file(path, 0);
+	}
+
+	measure("dir/fs_dir_next", dir_run, (void*)dir, BENCH_DIR_FILES, 0);
+
+	for (size_t i = 0; i < BENCH_DIR_FILES; ++ i) {
+		snprintf(path, sizeof(path), "%s/file%zu.c", dir, i);
+		fs_remove_file(path);
+	}
+
+	fs_remove_dir(dir);
+}
+
+#define BENCH_JOIN_OPS 10000
+
+static void join_run(void *data) {
+	(void)data;
+	for (size_t i = 0; i < BENCH_JOIN_OPS; ++ i) {
+		char *path = FS_JOIN_PATH("bin", "src/module/file.c", "o");
+		if (path == NULL)
+			LOG_FAIL("malloc()");
+
+		free(path);
+	}
+}
+
+#define BENCH_CMD_OPS 10
+
+static void cmd_run(void *data) {
+	(void)data;
+
+	const char *argv[] = {"true", NULL};
+	for (size_t i = 0; i < BENCH_CMD_OPS; ++ i)
+		cmd(argv);
+}
+
+static void bench_misc(void) {
+	measure("path/fs_join_path", join_run, NULL, BENCH_JOIN_OPS, 0);
+
+	/* Without the CMD lines, only the spawn and wait are left */
+	log_set_level(LOG_LEVEL_WARN);
+	measure("cmd/spawn", cmd_run, NULL, BENCH_CMD_OPS, 0);
+	log_set_level(LOG_LEVEL_INFO);
+}
+
+#define BENCH_ARGS_FLAGS 64
+#define BENCH_ARGS_OPS   10000
+
+static void args_run(void *data) {
+	args_t *a = (args_t*)data;
+	for (size_t i = 0; i < BENCH_ARGS_OPS; ++ i) {
+		if (args_parse_flags(a, NULL, NULL) != ARG_OK)
+			LOG_FATAL("args_parse_flags() failed");
+	}
+}
+
+/* Registered after the real flags are parsed, so they stay out of the usage */
+static void bench_args(void) {
+	if (!selected("args"))
+		return;
+
+	static char   names[BENCH_ARGS_FLAGS][32];
+	static size_t values[BENCH_ARGS_FLAGS];
+	static bool   bools[BENCH_ARGS_FLAGS];
+	for (size_t i = 0; i < BENCH_ARGS_FLAGS; ++ i) {
+		snprintf(names[i], sizeof(names[i]), "bench-flag-%zu", i);
+		if (i % 2 == 0)
+			flag_size(NULL, names[i], "", &values[i]);
+		else
+			flag_bool(NULL, names[i], "", &bools[i]);
+	}
+
+	/* Every other flag, half of the values after '=' and half as the next argument */
+	static char  args[BENCH_ARGS_FLAGS][48];
+	const char  *argv[BENCH_ARGS_FLAGS * 2];
+	int          argc = 0;
+	for (size_t i = 0; i < BENCH_ARGS_FLAGS; i += 2) {
+		if (i % 4 == 0) {
+			snprintf(args[i], sizeof(args[i]), "--%s=%zu", names[i], i);
+			argv[argc ++] = args[i];
+		} else {
+			snprintf(args[i], sizeof(args[i]), "--%s", names[i]);
+			argv[argc ++] = args[i];
+			argv[argc ++] = "42";
+		}
+
+		snprintf(args[i + 1], sizeof(args[i + 1]), "--%s", names[i + 1]);
+		argv[argc ++] = args[i + 1];
+	}
+
+	args_t a = new_args(argc, argv);
+	measure("args/args_parse_flags", args_run, &a, BENCH_ARGS_OPS, 0);
+}
+
+int main(int argc, const char **argv) {
+	args_t a = build_init(argc, argv);
+	build_set_usage("[OPTIONS]");
+
+	flag_size(NULL, "size",   "Size of the benchmarked files in MiB",          &size_mb);
+	flag_size(NULL, "runs",   "How many times to sample each benchmark",       &runs);
+	flag_size(NULL, "warmup", "How many times to run each benchmark unsampled", &warmup);
+	flag_bool(NULL, "perf",   "Also count cycles, instructions and misses",     &use_perf);
+	flag_cstr(NULL, "filter", "Only run the benchmarks starting with this",     &filter);
+
+	build_parse_args(&a, NULL);
+
+	if (runs == 0) {
+		build_arg_error("At least one run is needed");
+		exit(EXIT_FAILURE);
+	}
+
+	if (use_perf && !perf_open()) {
+		LOG_WARN("perf_event_open() is not available, running without counters");
+		use_perf = false;
+	}
+
+	if (!fs_exists(BENCH_DIR) && fs_create_dir(BENCH_DIR) != 0)
+		LOG_FATAL("Failed to create directory '%s'", BENCH_DIR);
+
+	bench_copy();
+	bench_embed();
+	bench_compress();
+	bench_log();
+	bench_cache();
+	bench_dir();
+	bench_misc();
+	bench_args();
+
+	if (use_perf)
+		perf_close();
+
+	fs_remove_dir(BENCH_DIR);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,358 @@
+/*
+ * Compile and run me with:
+ *   $ cc project.c -O2 -o project
+ *   $ ./project
+ *
+ * Generates a synthetic project, builds it with cbuilder in different situations and writes the
+ * timings as JSON lines, one object per benchmark, to compare between versions
+ *
+ */
+
+#include <time.h>  /* clock_gettime, CLOCK_MONOTONIC, time */
+#include <utime.h> /* utime, struct utimbuf */
+
+#define CBUILDER_IMPLEMENTATION
+#include "../cbuilder.h"
+
+#define BENCH_DIR "bench-project"
+
+static size_t files    = 200;
+static size_t headers  = 20;
+static size_t fan_in   = 5;
+static size_t depth    = 2;
+static size_t asset_kb = 1024;
+static size_t runs     = 5;
+static char  *cc_path  = (char*)CC;
+static char  *out_path = (char*)"project.jsonl";
+static char  *lib_dir  = (char*)"..";
+static FILE  *results  = NULL;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int double_cmp(const void *a, const void *b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+/* Prints the minimum and median of the samples, and writes them with the project shape so
+   results of differently sized projects are never compared by accident */
+static void report(const char *name, double *secs, size_t count, size_t bytes) {
+	qsort(secs, count, sizeof(*secs), double_cmp);
+
+	double min = secs[0], median = secs[count / 2];
+	if (bytes == 0)
+		printf("%-24s min %10.3f ms, median %10.3f ms\n", name, min * 1e3, median * 1e3);
+	else
+		printf("%-24s min %10.3f ms, median %10.3f ms %10.1f MB/s\n", name, min * 1e3,
+		       median * 1e3, (double)bytes / 1e6 / min);
+
+	fprintf(results, "{\"name\":\"%s\",\"files\":%zu,\"headers\":%zu,\"fan_in\":%zu,\"depth\":%zu,"
+	        "\"asset_kb\":%zu,\"runs\":%zu,\"min_ms\":%.3f,\"median_ms\":%.3f",
+	        name, files, headers, fan_in, depth, asset_kb, count, min * 1e3, median * 1e3);
+	if (bytes > 0)
+		fprintf(results, ",\"mb_per_s\":%.1f", (double)bytes / 1e6 / min);
+
+	fprintf(results, "}\n");
+}
+
+static FILE *create(const char *path) {
+	FILE *f = fopen(path, "w");
+	if (f == NULL)
+		LOG_FATAL("Failed to create '%s'", path);
+
+	return f;
+}
+
+static void create_dir(const char *path) {
+	if (!fs_exists(path) && fs_create_dir(path) != 0)
+		LOG_FATAL("Failed to create directory '%s'", path);
+}
+
+/* Every edit gets its own second, the build cache only sees whole seconds */
+static void touch(const char *path) {
+	static time_t bump = 0;
+
+	struct utimbuf t;
+	t.actime = t.modtime = time(NULL) + ++ bump;
+	if (utime(path, &t) != 0)
+		LOG_FATAL("Failed to touch '%s'", path);
+}
+
+/* Sources are spread over up to 8 subdirectories on each level */
+static char *source_path(size_t i) {
+	char dir[256] = "src";
+	for (size_t level = 0; level < depth; ++ level) {
+		size_t len = strlen(dir);
+		snprintf(dir + len, sizeof(dir) - len, "/d%zu", (i >> (level * 3)) & 7);
+		create_dir(dir);
+	}
+
+	char name[64];
+	snprintf(name, sizeof(name), "file%zu.c", i);
+
+	char *path = FS_JOIN_PATH(dir, name);
+	if (path == NULL)
+		LOG_FAIL("malloc()");
+
+	return path;
+}
+
+static void generate_asset(const char *path) {
+	FILE *f = create(path);
+
+	static unsigned char buf[64 * 1024];
+	uint32_t state = 0x12345678;
+	for (size_t written = 0; written < asset_kb * 1024; written += sizeof(buf)) {
+		for (size_t i = 0; i < sizeof(buf); ++ i) {
+			state = state * 1664525 + 1013904223;
+			buf[i] = (unsigned char)(state >> 24);
+		}
+
+		size_t n = asset_kb * 1024 - written < sizeof(buf)? asset_kb * 1024 - written : sizeof(buf);
+		if (fwrite(buf, 1, n, f) != n)
+			LOG_FATAL("Failed to write '%s'", path);
+	}
+
+	fclose(f);
+}
+
+static void generate(void) {
+	create_dir("src");
+	create_dir("src/include");
+	create_dir("gen");
+	create_dir("assets");
+
+	char path[256];
+	for (size_t i = 0; i < headers; ++ i) {
+		snprintf(path, sizeof(path), "src/include/h%zu.h", i);
+		FILE *f = create(path);
+		fprintf(f, "#ifndef H%zu_H\n#define H%zu_H\n\n"
+		           "static inline int h%zu(int x) {\n"
+		           "\tfor (int i = 0; i < %zu; ++ i)\n"
+		           "\t\tx = x * 31 + i;\n\n"
+		           "\treturn x;\n"
+		           "}\n\n#endif\n", i, i, i, i + 1);
+		fclose(f);
+	}
+
+	for (size_t i = 0; i < files; ++ i) {
+		char *src = source_path(i);
+		FILE *f   = create(src);
+
+		/* Spread the includes so every header is used by about as many sources */
+		for (size_t j = 0; j < fan_in && headers > 0; ++ j)
+			fprintf(f, "#include \"h%zu.h\"\n", (i + j * 7) % headers);
+
+		fprintf(f, "\nint f%zu(void) {\n\tint x = %zu;\n", i, i);
+		for (size_t j = 0; j < fan_in && headers > 0; ++ j)
+			fprintf(f, "\tx += h%zu(x);\n", (i + j * 7) % headers);
+
+		fprintf(f, "\treturn x;\n}\n");
+		fclose(f);
+		free(src);
+	}
+
+	FILE *f = create("src/main.c");
+	fprintf(f, "#include <stdio.h>\n\n#define EMBED_NAME      data\n"
+	           "#define EMBED_SIZE_NAME data_size\n#include \"data.h\"\n\n");
+	for (size_t i = 0; i < files; ++ i)
+		fprintf(f, "int f%zu(void);\n", i);
+
+	fprintf(f, "\nint main(void) {\n\tint x = (int)data_size + data[0];\n");
+	for (size_t i = 0; i < files; ++ i)
+		fprintf(f, "\tx += f%zu();\n", i);
+
+	fprintf(f, "\tprintf(\"%%i\\n\", x);\n\treturn 0;\n}\n");
+	fclose(f);
+
+	generate_asset("assets/data.bin");
+
+	f = create("build.c");
+	fprintf(f, "#define CARGS \"-O0\", \"-Isrc/include\", \"-Igen\"\n\n"
+	           "#define CBUILDER_IMPLEMENTATION\n#include \"cbuilder.h\"\n\n"
+	           "int main(int argc, const char **argv) {\n"
+	           "\targs_t a = build_init(argc, argv);\n"
+	           "\targs_t stripped;\n"
+	           "\tbuild_parse_args(&a, &stripped);\n\n"
+	           "\tif (stripped.c > 0 && strcmp(stripped.v[0], \"clean\") == 0)\n"
+	           "\t\tbuild_clean(\"bin\");\n"
+	           "\telse {\n"
+	           "\t\tembed(\"assets/data.bin\", \"gen/data.h\", BYTE_STRING);\n\n"
+	           "\t\tconst char *srcs[] = {\"src/**/*.{c,h}\"};\n"
+	           "\t\tbuild(\"%s\", srcs, 1, \"bin\", \"bin/app\");\n"
+	           "\t}\n\n"
+	           "\tfree(stripped.base);\n"
+	           "\treturn EXIT_SUCCESS;\n"
+	           "}\n", cc_path);
+	fclose(f);
+}
+
+static double run_build(const char *arg) {
+	double start = now();
+	if (arg == NULL)
+		CMD("./build", "-q");
+	else
+		CMD("./build", "-q", arg);
+
+	return now() - start;
+}
+
+static void bench_builds(void) {
+	double *secs = (double*)malloc(runs * sizeof(*secs));
+	if (secs == NULL)
+		LOG_FAIL("malloc()");
+
+	for (size_t r = 0; r < runs; ++ r) {
+		if (fs_exists("bin"))
+			run_build("clean");
+
+		fs_remove_file("gen/data.h");
+		secs[r] = run_build(NULL);
+	}
+	report("build/full", secs, runs, 0);
+
+	for (size_t r = 0; r < runs; ++ r)
+		secs[r] = run_build(NULL);
+	report("build/no-op", secs, runs, 0);
+
+	char *src = source_path(files / 2);
+	for (size_t r = 0; r < runs; ++ r) {
+		touch(src);
+		secs[r] = run_build(NULL);
+	}
+	report("build/source-edit", secs, runs, 0);
+	free(src);
+
+	if (headers > 0) {
+		for (size_t r = 0; r < runs; ++ r) {
+			touch("src/include/h0.h");
+			secs[r] = run_build(NULL);
+		}
+		report("build/header-edit", secs, runs, 0);
+	}
+
+	free(secs);
+}
+
+/* Loads and saves the cache the builds above left behind */
+static void bench_cache(void) {
+	double *load = (double*)malloc(runs * sizeof(*load));
+	double *save = (double*)malloc(runs * sizeof(*save));
+	if (load == NULL || save == NULL)
+		LOG_FAIL("malloc()");
+
+	for (size_t r = 0; r < runs; ++ r) {
+		build_cache_t c;
+
+		double start = now();
+		if (build_cache_load(&c) != 0)
+			LOG_FATAL("Build cache is corrupted");
+
+		load[r] = now() - start;
+
+		/* Unchanged caches are not written at all */
+		c.dirty = true;
+
+		start = now();
+		if (build_cache_save(&c) != 0)
+			LOG_FATAL("Failed to save build cache");
+
+		save[r] = now() - start;
+		build_cache_free(&c);
+	}
+
+	report("cache/load", load, runs, 0);
+	report("cache/save", save, runs, 0);
+
+	free(load);
+	free(save);
+}
+
+static void bench_embed(void) {
+	struct {
+		const char *name;
+		int         type;
+	} cases[] = {
+		{"embed/bytes",      BYTE_ARRAY},
+		{"embed/string",     BYTE_STRING},
+		{"embed/compressed", BYTE_STRING | EMBED_COMPRESSED},
+	};
+
+	double *secs = (double*)malloc(runs * sizeof(*secs));
+	if (secs == NULL)
+		LOG_FAIL("malloc()");
+
+	/* embed() skips outputs that are up to date, generate them directly */
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++ i) {
+		for (size_t r = 0; r < runs; ++ r) {
+			double start = now();
+			if (!embed_generate("assets/data.bin", "gen/bench.h", cases[i].type, 0))
+				LOG_FATAL("Failed to embed 'assets/data.bin'");
+
+			secs[r] = now() - start;
+		}
+
+		report(cases[i].name, secs, runs, asset_kb * 1024);
+	}
+
+	fs_remove_file("gen/bench.h");
+	free(secs);
+}
+
+int main(int argc, const char **argv) {
+	args_t a = build_init(argc, argv);
+	build_set_usage("[OPTIONS]");
+
+	flag_size(NULL, "files",    "How many source files to generate",          &files);
+	flag_size(NULL, "headers",  "How many headers to generate",               &headers);
+	flag_size(NULL, "fan-in",   "How many headers each source includes",      &fan_in);
+	flag_size(NULL, "depth",    "How deep the sources are nested",            &depth);
+	flag_size(NULL, "asset",    "Size of the embedded asset in KiB",          &asset_kb);
+	flag_size(NULL, "runs",     "How many times to run each benchmark",       &runs);
+	flag_cstr(NULL, "cc",       "Compiler used by the generated project",     &cc_path);
+	flag_cstr(NULL, "lib",      "Directory with cbuilder.h",                  &lib_dir);
+	flag_cstr("o",  "out",      "Where to write the results as JSON lines",   &out_path);
+
+	build_parse_args(&a, NULL);
+
+	if (runs == 0) {
+		build_arg_error("At least one run is needed");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Opened before moving into the project, so relative paths are where the user expects */
+	results = fopen(out_path, "w");
+	if (results == NULL)
+		LOG_FATAL("Failed to open '%s'", out_path);
+
+	char *include = fs_abs_path(lib_dir);
+	if (include == NULL)
+		LOG_FATAL("Failed to find '%s'", lib_dir);
+
+	create_dir(BENCH_DIR);
+	if (chdir(BENCH_DIR) != 0)
+		LOG_FAIL("chdir()");
+
+	generate();
+	CMD(CC, "build.c", "-O2", "-I", include, "-o", "build");
+	free(include);
+
+	/* Only the failures of the benchmarked commands are interesting */
+	log_set_level(LOG_LEVEL_WARN);
+
+	bench_builds();
+	bench_cache();
+	bench_embed();
+
+	fclose(results);
+
+	if (chdir("..") != 0)
+		LOG_FAIL("chdir()");
+
+	CMD("rm", "-rf", BENCH_DIR);
+	return EXIT_SUCCESS;
+}
@@ -15,12 +15,12 @@ extern "C" {
 #include <stdio.h>   /* fprintf, stderr, FILE */
 #include <stdlib.h>  /* size_t, malloc, free, strtol, strtoull, strtod */
 #include <stdbool.h> /* bool, true, false */
-#include <string.h>  /* strcmp, strlen, strdup, strcpy, strncpy */
-#include <assert.h>  /* assert */
+#include <stdint.h>  /* uint32_t */
+#include <string.h>  /* strcmp, strncmp, strlen, strchr, memset */
 
 #define CARGS_VERSION_MAJOR 1
-#define CARGS_VERSION_MINOR 2
-#define CARGS_VERSION_PATCH 1
+#define CARGS_VERSION_MINOR 3
+#define CARGS_VERSION_PATCH 0
 
 #define FOREACH_IN_ARGS(ARGS, ARG_VAR, BODY) \
 	do { \
@@ -144,117 +144,170 @@ typedef struct {
 	const char *short_name, *long_name, *desc;
 } flag_t;
 
-#define FLAGS_CAPACITY 128
+flag_t *flags       = NULL;
+size_t  flags_count = 0;
+size_t  flags_cap   = 0;
 
-flag_t flags[FLAGS_CAPACITY];
-size_t flags_count = 0;
+/* Open addressing index into flags, 0 is an empty slot and i + 1 refers to flags[i] */
+static size_t *flags_index     = NULL;
+static size_t  flags_index_cap = 0;
+static bool    flags_oom       = false;
 
-static flag_t *get_flag_by_short_name(const char *short_name) {
-	if (short_name == NULL)
+static size_t flag_hash(const char *name, size_t len, bool is_long) {
+	uint32_t h = is_long? 2166136261u : 84696351u;
+	for (size_t i = 0; i < len; ++ i) {
+		h ^= (unsigned char)name[i];
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+static bool flag_name_eq(const char *a, const char *b, size_t len) {
+	return a != NULL && strncmp(a, b, len) == 0 && a[len] == '\0';
+}
+
+static flag_t *flag_find(const char *name, size_t len, bool is_long) {
+	if (flags_index_cap == 0)
 		return NULL;
 
-	for (size_t i = 0; i < flags_count; ++ i) {
-		if (strcmp(flags[i].short_name, short_name) == 0)
-			return &flags[i];
+	size_t mask = flags_index_cap - 1;
+	for (size_t i = flag_hash(name, len, is_long) & mask; flags_index[i] != 0; i = (i + 1) & mask) {
+		flag_t *f = &flags[flags_index[i] - 1];
+		if (flag_name_eq(is_long? f->long_name : f->short_name, name, len))
+			return f;
 	}
 
 	return NULL;
 }
 
-static flag_t *get_flag_by_long_name(const char *long_name) {
-	if (long_name == NULL)
-		return NULL;
+static void flag_index_insert(const char *name, bool is_long, size_t idx) {
+	/* The first flag registered with a name wins, like the old linear scan */
+	if (name == NULL || flag_find(name, strlen(name), is_long) != NULL)
+		return;
+
+	size_t mask = flags_index_cap - 1;
+	size_t i    = flag_hash(name, strlen(name), is_long) & mask;
+	while (flags_index[i] != 0)
+		i = (i + 1) & mask;
+
+	flags_index[i] = idx + 1;
+}
+
+static bool flag_index_grow(void) {
+	size_t  cap   = flags_index_cap == 0? 64 : flags_index_cap * 2;
+	size_t *index = (size_t*)calloc(cap, sizeof(*index));
+	if (index == NULL)
+		return false;
+
+	free(flags_index);
+	flags_index     = index;
+	flags_index_cap = cap;
 
 	for (size_t i = 0; i < flags_count; ++ i) {
-		if (strcmp(flags[i].long_name, long_name) == 0)
-			return &flags[i];
+		flag_index_insert(flags[i].short_name, false, i);
+		flag_index_insert(flags[i].long_name,  true,  i);
 	}
 
-	return NULL;
+	return true;
 }
 
-void flag_cstr(const char *short_name, const char *long_name, const char *desc, char **var) {
-	assert(flags_count < FLAGS_CAPACITY);
-
-	flags[flags_count].type       = FLAG_CSTR;
-	flags[flags_count].as.cstr    = var;
-	flags[flags_count].def.cstr   = *var;
-	flags[flags_count].short_name = short_name;
-	flags[flags_count].long_name  = long_name;
-	flags[flags_count].desc       = desc;
+static flag_t *flag_new(flag_type_t type, const char *short_name, const char *long_name,
+                        const char *desc) {
+	if (flags_count >= flags_cap) {
+		size_t  cap = flags_cap == 0? 32 : flags_cap * 2;
+		flag_t *tmp = (flag_t*)realloc(flags, cap * sizeof(*flags));
+		if (tmp == NULL) {
+			flags_oom = true;
+			return NULL;
+		}
+
+		flags     = tmp;
+		flags_cap = cap;
+	}
+
+	/* Each flag takes up to two slots, keep the index at most half full */
+	if ((flags_count + 1) * 4 > flags_index_cap && !flag_index_grow()) {
+		flags_oom = true;
+		return NULL;
+	}
+
+	flag_t *f = &flags[flags_count];
+	memset(f, 0, sizeof(*f));
+	f->type       = type;
+	f->short_name = short_name;
+	f->long_name  = long_name;
+	f->desc       = desc;
+
+	flag_index_insert(short_name, false, flags_count);
+	flag_index_insert(long_name,  true,  flags_count);
 	++ flags_count;
+	return f;
+}
+
+void flag_cstr(const char *short_name, const char *long_name, const char *desc, char **var) {
+	flag_t *f = flag_new(FLAG_CSTR, short_name, long_name, desc);
+	if (f == NULL)
+		return;
+
+	f->as.cstr  = var;
+	f->def.cstr = *var;
 }
 
 void flag_char(const char *short_name, const char *long_name, const char *desc, char *var) {
-	assert(flags_count < FLAGS_CAPACITY);
-
-	flags[flags_count].type       = FLAG_CHAR;
-	flags[flags_count].as.ch      = var;
-	flags[flags_count].def.ch     = *var;
-	flags[flags_count].short_name = short_name;
-	flags[flags_count].long_name  = long_name;
-	flags[flags_count].desc       = desc;
-	++ flags_count;
+	flag_t *f = flag_new(FLAG_CHAR, short_name, long_name, desc);
+	if (f == NULL)
+		return;
+
+	f->as.ch  = var;
+	f->def.ch = *var;
 }
 
 void flag_int(const char *short_name, const char *long_name, const char *desc, int *var) {
-	assert(flags_count < FLAGS_CAPACITY);
-
-	flags[flags_count].type       = FLAG_INT;
-	flags[flags_count].as.int_    = var;
-	flags[flags_count].def.int_   = *var;
-	flags[flags_count].short_name = short_name;
-	flags[flags_count].long_name  = long_name;
-	flags[flags_count].desc       = desc;
-	++ flags_count;
+	flag_t *f = flag_new(FLAG_INT, short_name, long_name, desc);
+	if (f == NULL)
+		return;
 
+	f->as.int_  = var;
+	f->def.int_ = *var;
 }
 
 void flag_size(const char *short_name, const char *long_name, const char *desc, size_t *var) {
-	assert(flags_count < FLAGS_CAPACITY);
-
-	flags[flags_count].type       = FLAG_SIZE;
-	flags[flags_count].as.size    = var;
-	flags[flags_count].def.size   = *var;
-	flags[flags_count].short_name = short_name;
-	flags[flags_count].long_name  = long_name;
-	flags[flags_count].desc       = desc;
-	++ flags_count;
+	flag_t *f = flag_new(FLAG_SIZE, short_name, long_name, desc);
+	if (f == NULL)
+		return;
+
+	f->as.size  = var;
+	f->def.size = *var;
 }
 
 void flag_float(const char *short_name, const char *long_name, const char *desc, double *var) {
-	assert(flags_count < FLAGS_CAPACITY);
-
-	flags[flags_count].type       = FLAG_FLOAT;
-	flags[flags_count].as.float_  = var;
-	flags[flags_count].def.float_ = *var;
-	flags[flags_count].short_name = short_name;
-	flags[flags_count].long_name  = long_name;
-	flags[flags_count].desc       = desc;
-	++ flags_count;
+	flag_t *f = flag_new(FLAG_FLOAT, short_name, long_name, desc);
+	if (f == NULL)
+		return;
+
+	f->as.float_  = var;
+	f->def.float_ = *var;
 }
 
 void flag_bool(const char *short_name, const char *long_name, const char *desc, bool *var) {
-	assert(flags_count < FLAGS_CAPACITY);
-
-	flags[flags_count].type       = FLAG_BOOL;
-	flags[flags_count].as.bool_   = var;
-	flags[flags_count].def.bool_  = *var;
-	flags[flags_count].short_name = short_name;
-	flags[flags_count].long_name  = long_name;
-	flags[flags_count].desc       = desc;
-	++ flags_count;
+	flag_t *f = flag_new(FLAG_BOOL, short_name, long_name, desc);
+	if (f == NULL)
+		return;
+
+	f->as.bool_  = var;
+	f->def.bool_ = *var;
 }
 
 static int flag_set(flag_t *f, const char *val) {
 	switch (f->type) {
-	case FLAG_CSTR: {
-		*f->as.cstr = (char*)malloc(strlen(val) + 1);
-		strcpy(*f->as.cstr, val);
-	} break;
+	case FLAG_CSTR:
+		/* Borrowed from argv, which outlives the flags */
+		*f->as.cstr = (char*)val;
+		break;
 
 	case FLAG_CHAR:
-		if (strlen(val) != 1)
+		if (val[0] == '\0' || val[1] != '\0')
 			return ARG_EXPECTED_CHAR;
 
 		*f->as.ch = val[0];
@@ -302,13 +355,16 @@ static int flag_set(flag_t *f, const char *val) {
 int args_parse_flags(args_t *a, int *where, args_t *stripped) {
 	if (stripped != NULL) {
 		stripped->c    = 0;
-		stripped->base = (char**)malloc(sizeof(*stripped) * a->c);
+		stripped->base = (char**)malloc(sizeof(*stripped->base) * (a->c + 1));
 		if (stripped->base == NULL)
 			return ARG_OUT_OF_MEM;
 
 		stripped->v = (const char**)stripped->base;
 	}
 
+	if (flags_oom)
+		return ARG_OUT_OF_MEM;
+
 	bool flags_end = false;
 	for (int i = 0; i < a->c; ++ i) {
 		if (arg_is_flags_end(a->v[i]) && !flags_end) {
@@ -329,68 +385,30 @@ int args_parse_flags(args_t *a, int *where, args_t *stripped) {
 			*where = i;
 
 		bool is_long = arg_is_flag_long(a->v[i]);
-		const char *arg = a->v[i] + is_long + 1;
-
-		const char *tmp   = arg;
-		size_t      count = 0;
-		while (*arg != '\0' && *arg != '=') {
-			++ count;
-			++ arg;
-		}
+		const char *name = a->v[i] + is_long + 1;
+		const char *val  = strchr(name, '=');
+		size_t      len  = val == NULL? strlen(name) : (size_t)(val - name);
 
-		char *name = (char*)malloc(count + 1);
-		if (name == NULL)
-			return ARG_OUT_OF_MEM;
-
-		strncpy(name, tmp, count);
-		name[count] = '\0';
-
-		flag_t *flag = is_long? get_flag_by_long_name(name) : get_flag_by_short_name(name);
+		flag_t *flag = flag_find(name, len, is_long);
 		if (flag == NULL)
 			return ARG_UNKNOWN;
 
-		char *val = NULL;
-		if (*arg == '=') {
-			++ arg;
-
-			tmp   = arg;
-			count = 0;
-			while (*arg != '\0') {
-				++ count;
-				++ arg;
-			}
-
-			val = (char*)malloc(count + 1);
-			if (val == NULL)
-				return ARG_OUT_OF_MEM;
-
-			strncpy(val, tmp, count);
-			val[count] = '\0';
-		}
-
-		if (val == NULL) {
-			if (flag->type == FLAG_BOOL)
-				*flag->as.bool_ = true;
-			else {
-				++ i;
-				if (i >= a->c)
-					return ARG_MISSING_VALUE;
-
-				val = (char*)a->v[i];
-
-				int err = flag_set(flag, val);
-				if (err != ARG_OK)
-					return err;
-			}
+		if (val != NULL)
+			++ val;
+		else if (flag->type == FLAG_BOOL) {
+			*flag->as.bool_ = true;
+			continue;
 		} else {
-			int err = flag_set(flag, val);
-			if (err != ARG_OK)
-				return err;
+			++ i;
+			if (i >= a->c)
+				return ARG_MISSING_VALUE;
 
-			free(val);
+			val = a->v[i];
 		}
 
-		free(name);
+		int err = flag_set(flag, val);
+		if (err != ARG_OK)
+			return err;
 	}
 
 	return ARG_OK;
@@ -8,6 +8,17 @@
 #ifndef CBUILDER_H_HEADER_GUARD
 #define CBUILDER_H_HEADER_GUARD
 
+/* The system headers are included before the implementations of the other headers ask for POSIX,
+   so it is done here. wait4 and getloadavg also need the BSD additions */
+#if defined(CBUILDER_IMPLEMENTATION) && defined(__STRICT_ANSI__)
+#	ifndef _POSIX_C_SOURCE
+#		define _POSIX_C_SOURCE 200809L
+#	endif
+#	ifndef _DEFAULT_SOURCE
+#		define _DEFAULT_SOURCE
+#	endif
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -23,8 +34,8 @@ extern "C" {
 #include "cfs.h"
 
 #define CBUILDER_VERSION_MAJOR 1
-#define CBUILDER_VERSION_MINOR 3
-#define CBUILDER_VERSION_PATCH 2
+#define CBUILDER_VERSION_MINOR 18
+#define CBUILDER_VERSION_PATCH 0
 
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
 #	define BUILD_PLATFORM_WINDOWS
@@ -47,6 +58,9 @@ extern "C" {
 #	include <unistd.h>
 #	include <sys/types.h>
 #	include <sys/wait.h>
+#	include <sys/file.h>
+#	include <sys/resource.h>
+#	include <errno.h>
 
 #	define CC  "cc"
 #	define CXX "c++"
@@ -54,6 +68,7 @@ extern "C" {
 
 #define BUILD_APP_NAME   "./build"
 #define BUILD_CACHE_PATH ".cbuilder-cache"
+#define BUILD_DEPS_PATH  ".cbuilder-deps"
 
 void build_set_usage(const char *usage);
 void build_parse_args(args_t *a, args_t *stripped);
@@ -63,15 +78,26 @@ void build_arg_error(const char *fmt, ...);
 typedef struct {
 	char   *path;
 	int64_t mtime;
+	bool    dirty; /* Changed since the load, saving keeps it over what is on disk */
 } build_cache_item_t;
 
+/* Saving merges the changed entries into the cache on disk under a lock, so builds running at
+   the same time do not lose each others entries */
 typedef struct {
 	build_cache_item_t *buf;
 	size_t              count, size;
+	bool                dirty; /* Only a changed cache is written back */
+	char               *path;  /* Where it was loaded from and gets saved to */
+
+	/* Open addressing hash table of indices into buf plus one, 0 for an empty slot. It covers
+	   the first indexed entries and catches up on the rest when an entry is looked up */
+	size_t *index;
+	size_t  index_size, indexed;
 } build_cache_t;
 
 int  build_cache_delete(void);
-int  build_cache_load(build_cache_t *c);
+int  build_cache_load(build_cache_t *c); /* Opens the cache at BUILD_CACHE_PATH */
+int  build_cache_open(build_cache_t *c, const char *path);
 int  build_cache_save(build_cache_t *c);
 void build_cache_free(build_cache_t *c);
 
@@ -94,17 +120,49 @@ int64_t build_cache_get(build_cache_t *c, const char *path);
 		compile(NAME, (const char **)SRCS, SRCS_COUNT, args, sizeof(args) / sizeof(args[0])); \
 	} while (0)
 
+/* Registers a named compiler and flags for build(), selected with -c NAME, the first one is the
+   default. Every configuration builds into its own directory with its own cache, so switching
+   between them only copies the binary when nothing changed */
+#define BUILD_CONFIG(NAME, CC_, ...) \
+	do { \
+		const char *args[] = {__VA_ARGS__}; \
+		build_config(NAME, CC_, args, sizeof(args) / sizeof(args[0])); \
+	} while (0)
+
+/* Gives a registered configuration its own C++ compiler and flags, instead of the C flags */
+#define BUILD_CONFIG_CXX(NAME, CXX_, ...) \
+	do { \
+		const char *args[] = {__VA_ARGS__}; \
+		build_config_cxx(NAME, CXX_, args, sizeof(args) / sizeof(args[0])); \
+	} while (0)
+
 void cmd(const char **argv);
 void compile(const char *compiler, const char **srcs, size_t srcs_count,
              const char **args, size_t args_count);
 
+void build_config(    const char *name, const char *cc,  const char **args, size_t args_count);
+void build_config_cxx(const char *name, const char *cxx, const char **args, size_t args_count);
+void build_set_cxx(const char *cxx); /* For configurations without their own, CXX by default */
+
 enum {
 	STRING_ARRAY = 0,
 	BYTE_ARRAY,
+	BYTE_INCBIN, /* Let the compiler read the file with #embed, or the assembler with .incbin */
+	BYTE_STRING, /* Null terminated string literal, parsed much faster than BYTE_ARRAY */
 };
 
+/* Combined with BYTE_ARRAY or BYTE_STRING, the generated header then also has embed_unpack to
+   decompress the data, and EMBED_SIZE_NAME is the decompressed size */
+#define EMBED_COMPRESSED (1 << 8)
+
+#define EMBED_BUF_SIZE (1024 * 1024)
+
 void embed(const char *path, const char *out, int type);
 
+/* Packs every file under path into one aligned blob named EMBED_NAME, and generates
+   EMBED_NAME##_find to look files up by their path relative to it, like "img/logo.png" */
+void embed_dir(const char *path, const char *out);
+
 void build_clean(const char *path);
 void build(const char *cc, const char **srcs, size_t srcs_count, const char *bin, const char *out);
 
@@ -129,8 +187,15 @@ extern "C" {
 #define CFS_IMPLEMENTATION
 #include "cfs.h"
 
-static bool _build_help = false;
-static bool _build_ver  = false;
+static bool _build_help    = false;
+static bool _build_ver     = false;
+static bool _build_quiet   = false;
+static bool _build_verbose = false;
+
+static char  *_build_config_name = NULL;
+static size_t _build_jobs        = 0;
+static double _build_max_load    = 0;
+static size_t _build_memory      = 0; /* MiB */
 
 static const char *_build_usage = "[OPTIONS]";
 
@@ -138,8 +203,14 @@ args_t build_init(int argc, const char **argv) {
 	args_t a = new_args(argc, argv);
 	args_shift(&a);
 
-	flag_bool("h", "help",    "Show the usage",   &_build_help);
-	flag_bool("v", "version", "Show the version", &_build_ver);
+	flag_bool( "h",  "help",     "Show the usage",                             &_build_help);
+	flag_bool( "V",  "version",  "Show the version",                           &_build_ver);
+	flag_bool( "q",  "quiet",    "Only show warnings and errors",              &_build_quiet);
+	flag_bool( "v",  "verbose",  "Also show why files are not built",          &_build_verbose);
+	flag_cstr( "c",  "config",   "Build configuration to use",                 &_build_config_name);
+	flag_size( "j",  "jobs",     "Files compiled at a time, 0 for one per CPU", &_build_jobs);
+	flag_float("l",  "max-load", "No new compiles while the load is this high", &_build_max_load);
+	flag_size( NULL, "memory",   "MiB the compiles may use at once, 0 for any", &_build_memory);
 
 	log_set_flags(LOG_TIME);
 
@@ -185,33 +256,86 @@ void build_parse_args(args_t *a, args_t *stripped) {
 		       CBUILDER_VERSION_MAJOR, CBUILDER_VERSION_MINOR, CBUILDER_VERSION_PATCH);
 		exit(EXIT_SUCCESS);
 	}
+
+	if (_build_quiet)
+		log_set_level(LOG_LEVEL_WARN);
+	else if (_build_verbose)
+		log_set_level(LOG_LEVEL_DEBUG);
 }
 
-void cmd(const char **argv) {
-	char buf[1024] = {0};
+/* Logs and starts a command without waiting for it */
+static pid_t cmd_start(const char **argv, struct timespec *start) {
+	size_t len = 1;
+	for (const char **next = argv; *next != NULL; ++ next)
+		len += strlen(*next) + 1;
+
+	char *buf = (char*)malloc(len);
+	if (buf == NULL)
+		LOG_FAIL("malloc()");
+
+	char *it = buf;
 	for (const char **next = argv; *next != NULL; ++ next) {
-		strcat(buf, *next);
-		strcat(buf, " ");
+		size_t arg_len = strlen(*next);
+		memcpy(it, *next, arg_len);
+		it    += arg_len;
+		*it ++ = ' ';
 	}
+	*it = '\0';
+
+	log_field_t fields[] = {log_field_strs("argv", argv)};
+	LOG_FIELDS(LOG_LEVEL_INFO, "CMD", fields, 1, "%s", buf);
+	free(buf);
 
-	LOG_CUSTOM("CMD", "%s", buf);
-	pid_t pid;
-	int   status;
+	clock_gettime(CLOCK_MONOTONIC, start);
 
-	pid_t pid_ = fork();
-	if (pid_ == 0) {
+	pid_t pid = fork();
+	if (pid == 0) {
 		if (execvp(argv[0], (char**)argv) == -1)
 			LOG_FAIL("execvp()");
 
 		exit(EXIT_SUCCESS);
-	} else if (pid_ == -1)
+	} else if (pid == -1)
 		LOG_FAIL("fork()");
-	else {
-		int status;
-		pid_ = wait(&status);
-		if (status != 0)
-			LOG_FATAL("Command '%s' exited with exitcode '%i'", argv[0], status);
-	}
+
+	return pid;
+}
+
+/* Logs how a command that was waited for ended, a failure at fail_level. Returns the exitcode */
+static int cmd_end(const char **argv, pid_t pid, int status, const struct timespec *start,
+                   int fail_level) {
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	/* Killed by a signal is reported like shells do */
+	int code = WIFEXITED(status)? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+
+	log_field_t fields[] = {
+		log_field_strs("argv", argv),
+		log_field_int("pid", pid),
+		log_field_float("duration_ms", (double)(end.tv_sec - start->tv_sec) * 1e3 +
+		                               (double)(end.tv_nsec - start->tv_nsec) / 1e6),
+		log_field_int("exit_code", code),
+	};
+
+	/* Only the JSON format gets a record for commands that succeeded */
+	if (code != 0)
+		LOG_FIELDS(fail_level, NULL, fields, 4, "Command '%s' exited with exitcode '%i'",
+		           argv[0], code);
+	else
+		LOG_FIELDS(LOG_LEVEL_INFO, "CMD", fields, 4, NULL);
+
+	return code;
+}
+
+void cmd(const char **argv) {
+	struct timespec start;
+	pid_t pid = cmd_start(argv, &start);
+
+	int status;
+	if (waitpid(pid, &status, 0) == -1)
+		LOG_FAIL("waitpid()");
+
+	cmd_end(argv, pid, status, &start, LOG_LEVEL_FATAL);
 }
 
 void compile(const char *compiler, const char **srcs, size_t srcs_count,
@@ -235,323 +359,2753 @@ void compile(const char *compiler, const char **srcs, size_t srcs_count,
 	free(argv);
 }
 
-static void embed_str_arr(FILE *f, FILE *o) {
-	fprintf(o, "static const char *EMBED_NAME[] = {\n\t\"");
+/* 64 bit FNV-1a, for stamps that have to change when any of what they cover changes */
+#define BUILD_HASH_INIT 14695981039346656037ULL
+
+static uint64_t build_hash(uint64_t h, const void *data, size_t size) {
+	for (size_t i = 0; i < size; ++ i)
+		h = (h ^ ((const unsigned char*)data)[i]) * 1099511628211ULL;
+
+	return h;
+}
+
+static uint64_t build_hash_int(uint64_t h, int64_t n) {
+	for (int i = 0; i < 64; i += 8)
+		h = (h ^ (((uint64_t)n >> i) & 0xFF)) * 1099511628211ULL;
+
+	return h;
+}
+
+/* Negative stamps would read back wrong from the cache */
+static int64_t build_stamp(uint64_t h) {
+	return (int64_t)(h >> 1);
+}
+
+/* Generated code is written through one large buffer instead of an fprintf call per byte */
+typedef struct {
+	FILE  *f;
+	char  *buf;
+	size_t len;
+	bool   failed;
+} embed_out_t;
+
+static void embed_flush(embed_out_t *o) {
+	if (o->len > 0 && fwrite(o->buf, 1, o->len, o->f) != o->len)
+		o->failed = true;
 
-	int ch;
-	while ((ch = fgetc(f)) != EOF) {
-		switch (ch) {
-		case '\t': fprintf(o, "\\t");  break;
-		case '\r': fprintf(o, "\\r");  break;
-		case '\v': fprintf(o, "\\v");  break;
-		case '\f': fprintf(o, "\\f");  break;
-		case '\b': fprintf(o, "\\b");  break;
-		case '\0': fprintf(o, "\\0");  break;
-		case '"':  fprintf(o, "\\\""); break;
-		case '\\': fprintf(o, "\\\\"); break;
+	o->len = 0;
+}
 
-		case '\n': {
-			int next = fgetc(f);
-			if (next != EOF)
-				fprintf(o, "\",\n\t\"");
+/* Make sure there is room for at least size more bytes */
+static char *embed_reserve(embed_out_t *o, size_t size) {
+	if (o->len + size > EMBED_BUF_SIZE)
+		embed_flush(o);
 
-			ungetc(next, f);
-		} break;
+	return o->buf + o->len;
+}
 
-		default:
-			if (ch >= ' ' && ch <= '~')
-				fprintf(o, "%c", (char)ch);
-			else
-				fprintf(o, "\\x%02X", ch);
+static void embed_write(embed_out_t *o, const char *str, size_t len) {
+	while (len > 0) {
+		size_t n = EMBED_BUF_SIZE - o->len;
+		if (n == 0) {
+			embed_flush(o);
+			continue;
 		}
+
+		if (n > len)
+			n = len;
+
+		memcpy(o->buf + o->len, str, n);
+		o->len += n;
+		str    += n;
+		len    -= n;
+	}
+}
+
+#define EMBED_WRITE_STR(O, STR) embed_write(O, STR, sizeof(STR) - 1)
+
+static const char embed_hex[] = "0123456789ABCDEF";
+
+/* Escape sequence for every byte that can not be written into a string literal as it is, an
+   empty entry means the byte is written out unchanged */
+static char embed_escapes[256][5];
+
+static void embed_init_escapes(void) {
+	static bool init = false;
+	if (init)
+		return;
+
+	for (int i = 0; i < 256; ++ i) {
+		if (i >= ' ' && i <= '~')
+			continue;
+
+		embed_escapes[i][0] = '\\';
+		embed_escapes[i][1] = 'x';
+		embed_escapes[i][2] = embed_hex[i >> 4];
+		embed_escapes[i][3] = embed_hex[i & 0xF];
+	}
+
+	strcpy(embed_escapes['\t'], "\\t");
+	strcpy(embed_escapes['\r'], "\\r");
+	strcpy(embed_escapes['\v'], "\\v");
+	strcpy(embed_escapes['\f'], "\\f");
+	strcpy(embed_escapes['\b'], "\\b");
+	strcpy(embed_escapes['\0'], "\\0");
+	strcpy(embed_escapes['"'],  "\\\"");
+	strcpy(embed_escapes['\\'], "\\\\");
+
+	init = true;
+}
+
+static void embed_str_arr(const unsigned char *data, size_t size, embed_out_t *o) {
+	embed_init_escapes();
+	EMBED_WRITE_STR(o, "static const char *EMBED_NAME[] = {\n\t\"");
+
+	const unsigned char *end = data + size;
+	while (data < end) {
+		/* Copy the longest run of bytes that need no escaping at once */
+		const unsigned char *run = data;
+		while (run < end && embed_escapes[*run][0] == '\0')
+			++ run;
+
+		embed_write(o, (const char*)data, run - data);
+		if (run >= end)
+			break;
+
+		data = run + 1;
+		if (*run == '\n') {
+			if (data < end)
+				EMBED_WRITE_STR(o, "\",\n\t\"");
+		} else
+			embed_write(o, embed_escapes[*run], strlen(embed_escapes[*run]));
 	}
 
-	fprintf(o, "\",\n};\n#undef EMBED_NAME\n");
+	EMBED_WRITE_STR(o, "\",\n};\n#undef EMBED_NAME\n");
 }
 
-static void embed_bytes(FILE *f, FILE *o) {
-	fprintf(o, "static unsigned char EMBED_NAME[] = {\n");
+#define EMBED_BYTES_PER_LINE 10
 
-	int byte;
-	for (size_t i = 0; (byte = fgetc(f)) != EOF; ++ i) {
-		if (i % 10 == 0) {
-			if (i > 0)
-				fprintf(o, "\n");
+/* Every byte is written as "0xNN, ", looked up from a table built on first use */
+static char embed_byte_strs[256][6];
 
-			fprintf(o, "\t");
+static void embed_bytes(const unsigned char *data, size_t size, embed_out_t *o) {
+	if (embed_byte_strs[0][0] == '\0') {
+		for (int i = 0; i < 256; ++ i) {
+			memcpy(embed_byte_strs[i], "0x", 2);
+			embed_byte_strs[i][2] = embed_hex[i >> 4];
+			embed_byte_strs[i][3] = embed_hex[i & 0xF];
+			memcpy(embed_byte_strs[i] + 4, ", ", 2);
 		}
+	}
+
+	EMBED_WRITE_STR(o, "static unsigned char EMBED_NAME[] = {\n");
+
+	for (size_t i = 0; i < size; i += EMBED_BYTES_PER_LINE) {
+		size_t count = size - i < EMBED_BYTES_PER_LINE? size - i : EMBED_BYTES_PER_LINE;
+		char  *it    = embed_reserve(o, 2 + sizeof(embed_byte_strs[0]) * EMBED_BYTES_PER_LINE);
 
-		fprintf(o, "0x%02X, ", byte);
+		if (i > 0)
+			*it ++ = '\n';
+
+		*it ++ = '\t';
+		for (size_t j = 0; j < count; ++ j, it += sizeof(embed_byte_strs[0]))
+			memcpy(it, embed_byte_strs[data[i + j]], sizeof(embed_byte_strs[0]));
+
+		o->len = it - o->buf;
 	}
 
-	fprintf(o, "\n};\n#undef EMBED_NAME\n");
+	EMBED_WRITE_STR(o, "\n};\n#undef EMBED_NAME\n");
 }
 
-void embed(const char *path, const char *out, int type) {
-	LOG_CUSTOM("EMBED", "'%s' into '%s'", path, out);
+#define EMBED_LINE_WIDTH 76
 
-	FILE *f = fopen(path, "r");
-	if (f == NULL) {
-		LOG_ERROR("Failed to open '%s' for embedding", path);
-		return;
-	}
+static bool embed_is_octal(unsigned char ch) {
+	return ch >= '0' && ch <= '7';
+}
 
-	FILE *o = fopen(out, "w");
-	if (o == NULL) {
-		LOG_ERROR("Failed to open '%s' to embed '%s' into it", out, path);
+/* Octal escapes take at most 3 digits, so unlike hex escapes they can always be terminated.
+   The short form is only used when the next byte is not an octal digit itself */
+static char embed_lit_escapes[256][5];
+
+static void embed_init_lit_escapes(void) {
+	static bool init = false;
+	if (init)
 		return;
-	}
 
-	fprintf(o, "/* %s */\n", path);
+	for (int i = 0; i < 256; ++ i) {
+		if (i >= ' ' && i <= '~')
+			continue;
 
-	if (type == STRING_ARRAY)
-		embed_str_arr(f, o);
-	else
-		embed_bytes(f, o);
+		char *it = embed_lit_escapes[i];
+		*it ++ = '\\';
+		if (i >= 0100)
+			*it ++ = '0' + (i >> 6);
+		if (i >= 010)
+			*it ++ = '0' + ((i >> 3) & 7);
 
-	fclose(o);
-	fclose(f);
+		*it = '0' + (i & 7);
+	}
+
+	strcpy(embed_lit_escapes['\n'], "\\n");
+	strcpy(embed_lit_escapes['\t'], "\\t");
+	strcpy(embed_lit_escapes['\r'], "\\r");
+	strcpy(embed_lit_escapes['"'],  "\\\"");
+	strcpy(embed_lit_escapes['\\'], "\\\\");
+
+	init = true;
 }
 
-static build_cache_item_t *build_cache_add(build_cache_t *c) {
-	++ c->count;
-	if (c->count >= c->size) {
-		c->size *= 2;
-		void *ptr = realloc(c->buf, c->size * sizeof(*c->buf));
-		if (ptr == NULL) {
-			free(c->buf);
-			LOG_FAIL("realloc()");
-		} else
-			c->buf = (build_cache_item_t*)ptr;
+/* Writes the data as a string literal split over lines, without the semicolon */
+static void embed_lit(const unsigned char *data, size_t size, embed_out_t *o) {
+	embed_init_lit_escapes();
+
+	if (size == 0)
+		EMBED_WRITE_STR(o, "\t\"\"");
+
+	size_t line = 0;
+	for (size_t i = 0; i < size; ++ i) {
+		unsigned char ch = data[i];
+
+		/* Room for the line start, the longest escape and the line end */
+		char *it = embed_reserve(o, 16);
+		if (line == 0) {
+			memcpy(it, "\t\"", 2);
+			it += 2;
+		}
+
+		const char *esc = embed_lit_escapes[ch];
+		if (esc[0] == '\0') {
+			/* "??" followed by certain characters is a trigraph in older C standards */
+			if (ch == '?' && i > 0 && data[i - 1] == '?')
+				*it ++ = '\\';
+
+			*it ++ = (char)ch;
+			++ line;
+		} else if (esc[1] <= '7' && esc[1] >= '0' && i + 1 < size && embed_is_octal(data[i + 1])) {
+			it[0] = '\\';
+			it[1] = '0' + (ch >> 6);
+			it[2] = '0' + ((ch >> 3) & 7);
+			it[3] = '0' + (ch & 7);
+			it   += 4;
+			line += 4;
+		} else {
+			size_t esc_len = strlen(esc);
+			memcpy(it, esc, esc_len);
+			it   += esc_len;
+			line += esc_len;
+		}
+
+		/* Break lines after newlines in the data too, to keep embedded text readable */
+		if (line >= EMBED_LINE_WIDTH || ch == '\n') {
+			memcpy(it, "\"\n", 2);
+			it  += 2;
+			line = 0;
+		}
+
+		o->len = it - o->buf;
 	}
 
-	return &c->buf[c->count - 1];
+	if (line > 0)
+		EMBED_WRITE_STR(o, "\"");
 }
 
-int build_cache_delete(void) {
-	return fs_remove_file(BUILD_CACHE_PATH);
+/* Pedantic warnings about strings longer than C99 requires compilers to support would break
+   builds using -Werror */
+#define EMBED_LIT_PUSH \
+	"#ifdef __GNUC__\n" \
+	"#\tpragma GCC diagnostic push\n" \
+	"#\tpragma GCC diagnostic ignored \"-Woverlength-strings\"\n" \
+	"#endif\n"
+
+#define EMBED_LIT_POP \
+	"#ifdef __GNUC__\n" \
+	"#\tpragma GCC diagnostic pop\n" \
+	"#endif\n"
+
+static void embed_str(const unsigned char *data, size_t size, embed_out_t *o) {
+	char decl[128];
+	int  len = snprintf(decl, sizeof(decl), "static const unsigned char EMBED_NAME[%zu] =\n", size + 1);
+
+	EMBED_WRITE_STR(o, EMBED_LIT_PUSH "\n");
+	embed_write(o, decl, len);
+	embed_lit(data, size, o);
+	EMBED_WRITE_STR(o, ";\n\n" EMBED_LIT_POP);
 }
 
-int build_cache_load(build_cache_t *c) {
-	c->count = 0;
-	c->size  = 16;
-	c->buf   = (build_cache_item_t*)malloc(c->size * sizeof(*c->buf));
-	if (c->buf == NULL)
-		LOG_FAIL("malloc()");
+/* Escapes str for the inside of a string literal like embed_lit does. The assembler takes the
+   same escapes, but not the one that breaks up trigraphs */
+static char *embed_escape(const char *str, bool trigraphs) {
+	embed_init_lit_escapes();
 
-	FILE *f = fopen(BUILD_CACHE_PATH, "r");
-	if (f != NULL) {
-		char line[PATH_MAX] = {0};
-		while (fgets(line, PATH_MAX, f) != NULL) {
-			size_t line_len = strlen(line);
-			if (line[line_len - 1] == '\n')
-				line[line_len - 1] = '\0';
-
-			if (line[0] != '"')
-				return -1;
-
-			size_t len = 0;
-			for (; line[len + 1] != '"'; ++ len) {
-				if (line[len + 1] == '\0')
-					return -1;
-			}
+	char *escaped = (char*)malloc(strlen(str) * 4 + 1);
+	if (escaped == NULL)
+		LOG_FAIL("malloc()");
 
-			build_cache_item_t *item = build_cache_add(c);
-			item->path = (char*)malloc(len + 1);
-			if (item->path == NULL)
-				LOG_FAIL("malloc()");
+	char *it = escaped;
+	for (const unsigned char *ch = (const unsigned char*)str; *ch != '\0'; ++ ch) {
+		const char *esc = embed_lit_escapes[*ch];
+		if (esc[0] == '\0') {
+			if (trigraphs && *ch == '?' && ch > (const unsigned char*)str && ch[-1] == '?')
+				*it ++ = '\\';
+
+			*it ++ = (char)*ch;
+		} else if (esc[1] <= '7' && esc[1] >= '0' && embed_is_octal(ch[1])) {
+			it[0] = '\\';
+			it[1] = '0' + (*ch >> 6);
+			it[2] = '0' + ((*ch >> 3) & 7);
+			it[3] = '0' + (*ch & 7);
+			it   += 4;
+		} else {
+			strcpy(it, esc);
+			it += strlen(esc);
+		}
+	}
 
-			memcpy(item->path, line + 1, len);
-			item->path[len] = '\0';
+	*it = '\0';
+	return escaped;
+}
 
-			char *num   = line + len + 3;
-			item->mtime = (int64_t)atoll(num);
-		}
+/* The generated header has the data included by the compiler with C23 #embed when it supports
+   it, and by the assembler with .incbin otherwise, so compiling it costs the same for any size.
+   Both need GCC or Clang. The size is known now, so sizeof works on the array either way */
+static void embed_incbin(FILE *o, const char *path, size_t size) {
+	char *abs = fs_abs_path(path);
+	if (abs == NULL)
+		LOG_FAIL("fs_abs_path()");
 
-		fclose(f);
+#ifdef BUILD_PLATFORM_WINDOWS
+	/* Forward slashes work everywhere */
+	for (char *it = abs; *it != '\0'; ++ it) {
+		if (*it == '\\')
+			*it = '/';
 	}
-	return 0;
+#endif
+
+	/* The path of .incbin is a string of the assembler inside of a string literal, so it is
+	   escaped twice. #embed takes no escapes at all, so it is left to .incbin for paths it
+	   cannot name */
+	char *asm_str = embed_escape(abs, false);
+	char *lit     = embed_escape(asm_str, true);
+	bool  named   = strpbrk(abs, "\"\\\n") == NULL;
+
+	fprintf(o,
+	        "#ifndef EMBED_STR\n"
+	        "#\tdefine EMBED_STR_(X) #X\n"
+	        "#\tdefine EMBED_STR(X)  EMBED_STR_(X)\n"
+	        "#endif\n"
+	        "\n"
+	        "#if %s\n"
+	        "static const unsigned char EMBED_NAME[%zu] = {\n"
+	        "#embed \"%s\"\n"
+	        "};\n"
+	        "#else\n"
+	        "#\tif defined(__APPLE__)\n"
+	        "#\t\tdefine EMBED_SECTION \".section __TEXT,__const\\n\"\n"
+	        "#\t\tdefine EMBED_PREVIOUS \".text\\n\"\n"
+	        "#\telif defined(_WIN32)\n"
+	        "#\t\tdefine EMBED_SECTION \".section .rdata,\\\"dr\\\"\\n\"\n"
+	        "#\t\tdefine EMBED_PREVIOUS \".text\\n\"\n"
+	        "#\telse\n"
+	        "#\t\tdefine EMBED_SECTION \".pushsection .rodata\\n\"\n"
+	        "#\t\tdefine EMBED_PREVIOUS \".popsection\\n\"\n"
+	        "#\tendif\n"
+	        "\n"
+	        "/* Not made global, so every file including this gets its own copy like with static */\n"
+	        "__asm__(EMBED_SECTION\n"
+	        "        \".balign 16\\n\"\n"
+	        "        EMBED_STR(__USER_LABEL_PREFIX__) EMBED_STR(EMBED_NAME) \":\\n\"\n"
+	        "        \".incbin \\\"%s\\\"\\n\"\n"
+	        "        EMBED_PREVIOUS);\n"
+	        "\n"
+	        "extern const unsigned char EMBED_NAME[%zu];\n"
+	        "\n"
+	        "#\tundef EMBED_SECTION\n"
+	        "#\tundef EMBED_PREVIOUS\n"
+	        "#endif\n",
+	        named? "defined(__has_embed)" : "0", size, named? abs : "", lit, size);
+
+	free(lit);
+	free(asm_str);
+	free(abs);
 }
 
-int build_cache_save(build_cache_t *c) {
-	FILE *f = fopen(BUILD_CACHE_PATH, "w");
-	if (f == NULL)
-		return -1;
+/* Compressed embeds use the LZ4 block format. The decompressor is compiled here for testing, and
+   written into the generated headers from the same source */
+#define EMBED_UNPACK_SRC(NAME) \
+	static long NAME(const unsigned char *src, unsigned long src_size, \
+	                 unsigned char *dst, unsigned long dst_size) { \
+		const unsigned char *ip = src, *ip_end = src + src_size; \
+		unsigned char       *op = dst, *op_end = dst + dst_size; \
+		while (ip < ip_end) { \
+			unsigned      token = *ip ++; \
+			unsigned long len   = token >> 4, off; \
+			if (len == 15) { \
+				do { \
+					if (ip >= ip_end) \
+						return -1; \
+					len += *ip; \
+				} while (*ip ++ == 255); \
+			} \
+			if (len > (unsigned long)(ip_end - ip) || len > (unsigned long)(op_end - op)) \
+				return -1; \
+			for (; len > 0; -- len) \
+				*op ++ = *ip ++; \
+			if (ip == ip_end) \
+				break; \
+			if (ip_end - ip < 2) \
+				return -1; \
+			off = ip[0] | (unsigned long)ip[1] << 8; \
+			ip += 2; \
+			if (off == 0 || off > (unsigned long)(op - dst)) \
+				return -1; \
+			len = token & 15; \
+			if (len == 15) { \
+				do { \
+					if (ip >= ip_end) \
+						return -1; \
+					len += *ip; \
+				} while (*ip ++ == 255); \
+			} \
+			len += 4; \
+			if (len > (unsigned long)(op_end - op)) \
+				return -1; \
+			for (; len > 0; -- len, ++ op) \
+				*op = op[-(long)off]; \
+		} \
+		return (long)(op - dst); \
+	}
 
-	for (size_t i = 0; i < c->count; ++ i)
-		fprintf(f, "\"%s\" %llu\n", c->buf[i].path, (unsigned long long)c->buf[i].mtime);
+#define EMBED_STR_(...) #__VA_ARGS__
+#define EMBED_STR(...)  EMBED_STR_(__VA_ARGS__)
 
-	fclose(f);
-	return 0;
+EMBED_UNPACK_SRC(embed_unpack)
+
+#define EMBED_LZ_MIN_MATCH     4
+#define EMBED_LZ_LAST_LITERALS 5  /* The format requires the last bytes to be literals */
+#define EMBED_LZ_MATCH_LIMIT   12 /* and the last match to start this far from the end */
+#define EMBED_LZ_HASH_BITS     16
+
+static uint32_t embed_read32(const unsigned char *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
 }
 
-void build_cache_free(build_cache_t *c) {
-	for (size_t i = 0; i < c->count; ++ i)
-		free(c->buf[i].path);
+static unsigned char *embed_lz_len(unsigned char *op, size_t len) {
+	for (; len >= 255; len -= 255)
+		*op ++ = 255;
 
-	free(c->buf);
-	c->buf   = NULL;
-	c->count = 0;
-	c->size  = 0;
+	*op ++ = (unsigned char)len;
+	return op;
 }
 
-void build_cache_set(build_cache_t *c, const char *path, int64_t mtime) {
-	for (size_t i = 0; i < c->count; ++ i) {
-		if (strcmp(c->buf[i].path, path) == 0) {
-			c->buf[i].mtime = mtime;
-			return;
+static unsigned char *embed_lz_seq(unsigned char *op, const unsigned char *lit, size_t lit_len,
+                                   size_t off, size_t match_len) {
+	unsigned char *token = op ++;
+	*token = (unsigned char)((lit_len < 15? lit_len : 15) << 4);
+	if (lit_len >= 15)
+		op = embed_lz_len(op, lit_len - 15);
+
+	memcpy(op, lit, lit_len);
+	op += lit_len;
+
+	if (match_len == 0)
+		return op;
+
+	*op ++ = (unsigned char)(off & 0xFF);
+	*op ++ = (unsigned char)(off >> 8);
+
+	match_len -= EMBED_LZ_MIN_MATCH;
+	*token |= (unsigned char)(match_len < 15? match_len : 15);
+	if (match_len >= 15)
+		op = embed_lz_len(op, match_len - 15);
+
+	return op;
+}
+
+/* Greedy single probe compressor, the output buffer is allocated and owned by the caller */
+static size_t embed_compress(const unsigned char *data, size_t size, unsigned char **out) {
+	*out = (unsigned char*)malloc(size + size / 255 + 16);
+	uint32_t *table = (uint32_t*)calloc(1 << EMBED_LZ_HASH_BITS, sizeof(*table));
+	if (*out == NULL || table == NULL)
+		LOG_FAIL("malloc()");
+
+	unsigned char *op = *out;
+	size_t anchor = 0, ip = 0;
+	while (size > EMBED_LZ_MATCH_LIMIT && ip < size - EMBED_LZ_MATCH_LIMIT) {
+		uint32_t seq  = embed_read32(data + ip);
+		uint32_t hash = (seq * 2654435761u) >> (32 - EMBED_LZ_HASH_BITS);
+
+		/* Positions are stored plus one, so zero means an empty slot */
+		size_t ref  = table[hash];
+		table[hash] = (uint32_t)(ip + 1);
+
+		if (ref == 0 || ip + 1 - ref > 0xFFFF || embed_read32(data + ref - 1) != seq) {
+			++ ip;
+			continue;
 		}
+
+		-- ref;
+		size_t len   = EMBED_LZ_MIN_MATCH;
+		size_t limit = size - EMBED_LZ_LAST_LITERALS;
+		while (ip + len < limit && data[ref + len] == data[ip + len])
+			++ len;
+
+		op     = embed_lz_seq(op, data + anchor, ip - anchor, ip - ref, len);
+		ip    += len;
+		anchor = ip;
 	}
 
-	build_cache_item_t *item = build_cache_add(c);
-	item->path = (char*)malloc(strlen(path) + 1);
-	if (item->path == NULL)
+	op = embed_lz_seq(op, data + anchor, size - anchor, 0, 0);
+	free(table);
+
+	/* A broken embed would only show up when the program runs, so check the round trip now, into
+	   a buffer of the exact size and a larger one */
+	size_t         packed_size = op - *out;
+	unsigned char *check       = (unsigned char*)malloc(size + 1);
+	if (check == NULL)
 		LOG_FAIL("malloc()");
 
-	strcpy(item->path, path);
-	item->mtime = mtime;
+	if (embed_unpack(*out, packed_size, check, size)     != (long)size ||
+	    embed_unpack(*out, packed_size, check, size + 1) != (long)size ||
+	    memcmp(check, data, size) != 0)
+		LOG_FAIL("embed_compress()");
+
+	free(check);
+	return packed_size;
 }
 
-int64_t build_cache_get(build_cache_t *c, const char *path) {
-	for (size_t i = 0; i < c->count; ++ i) {
-		if (strcmp(c->buf[i].path, path) == 0)
-			return c->buf[i].mtime;
+static bool embed_same_file(const char *a, const char *b) {
+	fs_map_t ma, mb;
+	if (fs_map_file(&ma, a) != 0)
+		return false;
+
+	if (fs_map_file(&mb, b) != 0) {
+		fs_unmap_file(&ma);
+		return false;
 	}
 
-	return (int64_t)-1;
+	bool same = ma.size == mb.size && memcmp(ma.data, mb.data, ma.size) == 0;
+
+	fs_unmap_file(&ma);
+	fs_unmap_file(&mb);
+	return same;
 }
 
-void build_clean(const char *path) {
-	bool found = false;
-	int  status;
-	FOREACH_IN_DIR(path, dir, ent, {
-		if (strcmp(fs_ext(ent.name), "o") != 0)
-			continue;
+static bool embed_generate(const char *path, const char *out, int type, int64_t mtime) {
+	fs_map_t m;
+	if (fs_map_file(&m, path) != 0) {
+		LOG_ERROR("Failed to open '%s' for embedding", path);
+		return false;
+	}
 
-		if (!found)
-			found = true;
+	embed_out_t o = {0};
+	o.f = fopen(out, "w");
+	if (o.f == NULL) {
+		LOG_ERROR("Failed to open '%s' to embed '%s' into it", out, path);
+		fs_unmap_file(&m);
+		return false;
+	}
 
-		char *path = FS_JOIN_PATH(dir.path, ent.name);
-		if (path == NULL)
-			LOG_FAIL("malloc()");
+	o.buf = (char*)malloc(EMBED_BUF_SIZE);
+	if (o.buf == NULL)
+		LOG_FAIL("malloc()");
 
-		fs_remove_file(path);
-		free(path);
-	}, status);
+	int  kind     = type & ~EMBED_COMPRESSED;
+	bool compress = type & EMBED_COMPRESSED;
+	if (compress && kind != BYTE_ARRAY && kind != BYTE_STRING) {
+		LOG_WARN("Only BYTE_ARRAY and BYTE_STRING embeds can be compressed, '%s' will not be", path);
+		compress = false;
+	}
 
-	if (status != 0)
-		LOG_FATAL("Failed to open directory '%s'", path);
+	/* The data of BYTE_INCBIN is not in the header, so the modification time has to be, or the
+	   header would stay the same when the data changes and nothing would get rebuilt */
+	if (kind == BYTE_INCBIN)
+		fprintf(o.f, "/* %s, modified at %lld */\n", path, (long long)mtime);
+	else
+		fprintf(o.f, "/* %s%s */\n", path, compress? ", compressed" : "");
+
+	const unsigned char *data = (const unsigned char*)m.data;
+	size_t               size = m.size;
+
+	unsigned char *packed = NULL;
+	if (compress) {
+		size = embed_compress(data, size, &packed);
+		data = packed;
+
+		EMBED_WRITE_STR(&o, "#ifndef EMBED_UNPACK_DEFINED\n"
+		                    "#\tdefine EMBED_UNPACK_DEFINED\n"
+		                    "/* Decompresses into dst and returns the decompressed size, or -1 if "
+		                    "the data is corrupted or dst is too small */\n"
+		                    "#\tifdef __GNUC__\n"
+		                    "__attribute__((unused))\n"
+		                    "#\tendif\n");
+		EMBED_WRITE_STR(&o, EMBED_STR(EMBED_UNPACK_SRC(embed_unpack)));
+		EMBED_WRITE_STR(&o, "\n#endif\n\n");
+	}
 
-	build_cache_delete();
+	switch (kind) {
+	case STRING_ARRAY: embed_str_arr(data, size, &o); break;
+	case BYTE_STRING:  embed_str(data, size, &o);     break;
 
-	if (!found)
-		LOG_INFO("Nothing to clean");
-	else
-		LOG_INFO("Cleaned '%s'", path);
-}
+	case BYTE_INCBIN:
+		embed_flush(&o);
+		embed_incbin(o.f, path, size);
+		break;
 
-#ifndef CARGS
-#	define CARGS
-#endif
+	default: embed_bytes(data, size, &o);
+	}
 
-#ifndef CLIBS
-#	define CLIBS
-#endif
+	/* Compressed embeds have the decompressed size as the constant, that is what the program
+	   needs to allocate */
+	if (compress || kind == BYTE_STRING || kind == BYTE_INCBIN) {
+		char trailer[256];
+		int  len = snprintf(trailer, sizeof(trailer),
+		                    "\n"
+		                    "#ifdef EMBED_SIZE_NAME\n"
+		                    "static const unsigned long EMBED_SIZE_NAME = %zuUL;\n"
+		                    "#\tundef EMBED_SIZE_NAME\n"
+		                    "#endif\n", m.size);
+		embed_write(&o, trailer, len);
+
+		if (kind != BYTE_ARRAY)
+			EMBED_WRITE_STR(&o, "#undef EMBED_NAME\n");
+	}
 
-static char *build_file(const char *cc, build_cache_t *c, const char *out_dir, const char *src_dir,
-                        const char *src_name, bool force_rebuild) {
-	char *out_name = fs_replace_ext(src_name, "o");
-	if (out_name == NULL)
-		LOG_FAIL("malloc()");
+	free(packed);
+
+	embed_flush(&o);
+	if (o.failed)
+		LOG_ERROR("Failed to write '%s'", out);
+
+	free(o.buf);
+	fclose(o.f);
+	fs_unmap_file(&m);
+	return !o.failed;
+}
 
-	char *out = FS_JOIN_PATH(out_dir, out_name);
-	char *src = FS_JOIN_PATH(src_dir, src_name);
-	if (out_name == NULL || out == NULL || src == NULL)
+static char *build_path_suffix(const char *path, const char *suffix) {
+	char *str = (char*)malloc(strlen(path) + strlen(suffix) + 1);
+	if (str == NULL)
 		LOG_FAIL("malloc()");
 
-	free(out_name);
+	strcpy(str, path);
+	strcat(str, suffix);
+	return str;
+}
 
-	int64_t m_cached = build_cache_get(c, src);
-	int64_t m_now;
-	if (fs_time(src, &m_now, NULL) != 0)
-		LOG_FATAL("Could not get last modified time of '%s'", src);
+/* A temporary file next to path that no other process or call writes to, for outputs that
+   builds running at the same time replace through a rename */
+static char *build_path_tmp(const char *path) {
+	static unsigned long counter = 0;
+
+#ifdef BUILD_PLATFORM_WINDOWS
+	unsigned long pid = (unsigned long)GetCurrentProcessId();
+#else
+	unsigned long pid = (unsigned long)getpid();
+#endif
+
+	char suffix[64];
+	snprintf(suffix, sizeof(suffix), ".%lu.%lu.tmp", pid, counter ++);
+	return build_path_suffix(path, suffix);
+}
 
-	if (m_cached != m_now || force_rebuild) {
-		build_cache_set(c, src, m_now);
-		CMD(cc, "-c", src, "-o", out, CARGS);
+/* Rewriting an unchanged output would bump its modification time, and with that rebuild
+   everything that includes it. The stamp is remembered in the cache under the output path */
+static void embed_replace(build_cache_t *c, const char *tmp, const char *out, int64_t stamp) {
+	if (embed_same_file(tmp, out))
+		fs_remove_file(tmp);
+	else if (fs_move_file(tmp, out) != 0) {
+		LOG_ERROR("Failed to move '%s' to '%s'", tmp, out);
+		fs_remove_file(tmp);
 	}
 
-	free(src);
-	return out;
+	build_cache_set(c, out, stamp);
+	if (build_cache_save(c) != 0)
+		LOG_FATAL("Failed to save build cache");
 }
 
-void build(const char *cc, const char **srcs, size_t srcs_count, const char *bin, const char *out) {
-	if (!fs_exists(bin))
-		fs_create_dir(bin);
+void embed(const char *path, const char *out, int type) {
+	int64_t mtime;
+	if (fs_time(path, &mtime, NULL) != 0) {
+		LOG_ERROR("Failed to open '%s' for embedding", path);
+		return;
+	}
 
-	char  *o_files[128];
-	size_t o_files_count = 0;
+	/* Embedding the file differently, or another file, has to regenerate the header too */
+	uint64_t hash = build_hash(BUILD_HASH_INIT, path, strlen(path) + 1);
+	hash = build_hash_int(hash, mtime);
+	hash = build_hash_int(hash, type);
+
+	int64_t stamp = build_stamp(hash);
 
 	build_cache_t c;
 	if (build_cache_load(&c) != 0)
 		LOG_FATAL("Build cache is corrupted");
 
-	bool rebuild_all = false;
+	if (build_cache_get(&c, out) == stamp && fs_exists(out)) {
+		LOG_DEBUG("'%s' is up to date", out);
+		build_cache_free(&c);
+		return;
+	}
 
-	for (size_t i = 0; i < srcs_count; ++ i) {
-		int status;
-		FOREACH_IN_DIR(srcs[i], dir, ent, {
-			if (strcmp(fs_ext(ent.name), "h") != 0)
-				continue;
+	LOG_CUSTOM("EMBED", "'%s' into '%s'", path, out);
 
-			char *src = FS_JOIN_PATH(srcs[i], ent.name);
-			if (src == NULL)
-				LOG_FAIL("malloc()");
+	/* Builds running at the same time each generate into their own temporary file */
+	char *tmp = build_path_tmp(out);
+	if (embed_generate(path, tmp, type, mtime))
+		embed_replace(&c, tmp, out, stamp);
+	else
+		fs_remove_file(tmp);
 
-			int64_t m_cached = build_cache_get(&c, src);
-			int64_t m_now;
-			if (fs_time(src, &m_now, NULL) != 0)
-				LOG_FATAL("Could not get last modified time of '%s'", src);
+	free(tmp);
+	build_cache_free(&c);
+}
 
-			if (m_cached != m_now) {
-				if (!rebuild_all)
-					rebuild_all = true;
+/* The lookup code of directory embeds is compiled here to build and check the tables, and
+   written into the generated headers from the same source. The hash is kept to 32 bits so it is
+   the same wherever the header is compiled */
+#define EMBED_DIR_TYPE_SRC \
+	typedef struct { \
+		const char   *path; \
+		unsigned long offset, size; \
+	} embed_dir_file_t;
+
+#define EMBED_DIR_SRC(FIND, HASH, ATTR) \
+	ATTR static unsigned long HASH(unsigned long seed, const char *str) { \
+		unsigned long h = (2166136261UL ^ seed) & 0xFFFFFFFFUL; \
+		for (; *str != '\0'; ++ str) \
+			h = ((h ^ (unsigned char)*str) * 16777619UL) & 0xFFFFFFFFUL; \
+		h ^= h >> 16; \
+		h  = (h * 0x45D9F3BUL) & 0xFFFFFFFFUL; \
+		return h ^ (h >> 16); \
+	} \
+	ATTR static const unsigned char *FIND(const unsigned char *blob, \
+	                                      const embed_dir_file_t *files, unsigned long count, \
+	                                      const unsigned long *seeds, unsigned long seeds_count, \
+	                                      const char *path, unsigned long *size) { \
+		const embed_dir_file_t *f; \
+		const char             *a, *b; \
+		if (count == 0) \
+			return 0; \
+		f = &files[HASH(seeds[HASH(0, path) % seeds_count], path) % count]; \
+		for (a = f->path, b = path; *a != '\0' && *a == *b; ++ a, ++ b); \
+		if (*a != *b) \
+			return 0; \
+		if (size != 0) \
+			*size = f->size; \
+		return blob + f->offset; \
+	}
 
-				build_cache_set(&c, src, m_now);
-			}
+EMBED_DIR_TYPE_SRC
+EMBED_DIR_SRC(embed_dir_find, embed_dir_hash, )
 
-			free(src);
-		}, status);
+/* Every file starts aligned, and is followed by at least one zero byte so text can be used as a
+   string right away */
+#define EMBED_DIR_ALIGN 16
 
-		if (status != 0)
-			LOG_FATAL("Failed to open directory '%s'", srcs[i]);
+/* How many keys share a displacement seed on average. The seeds of the last buckets take longer
+   to find when there are more, but there are fewer seeds to store */
+#define EMBED_DIR_BUCKET_SIZE 4
+#define EMBED_DIR_MAX_SEED    (1UL << 24)
 
-		FOREACH_IN_DIR(srcs[i], dir, ent, {
-			if (strcmp(fs_ext(ent.name), "c") != 0)
-				continue;
+typedef struct {
+	char         *path;
+	const char   *rel; /* Points into path, with forward slashes on every platform */
+	unsigned long hash, offset, size;
+} embed_dir_ent_t;
 
-			assert(o_files_count < sizeof(o_files) / sizeof(o_files[0]));
+typedef struct {
+	embed_dir_ent_t *buf;
+	size_t           count, size, root_len;
+} embed_dir_ents_t;
 
-			char *out = build_file(cc, &c, bin, srcs[i], ent.name, rebuild_all);
-			o_files[o_files_count ++] = out;
-		}, status);
+static void embed_dir_collect(const fs_walk_ent_t *ents, size_t count, void *data) {
+	embed_dir_ents_t *d = (embed_dir_ents_t*)data;
 
-		if (status != 0)
-			LOG_FATAL("Failed to open directory '%s'", srcs[i]);
+	for (size_t i = 0; i < count; ++ i) {
+		if (d->count >= d->size) {
+			d->size = d->size == 0? 64 : d->size * 2;
+			void *ptr = realloc(d->buf, d->size * sizeof(*d->buf));
+			if (ptr == NULL)
+				LOG_FAIL("realloc()");
+
+			d->buf = (embed_dir_ent_t*)ptr;
+		}
+
+		embed_dir_ent_t *e = &d->buf[d->count ++];
+		e->path = (char*)malloc(strlen(ents[i].path) + 1);
+		if (e->path == NULL)
+			LOG_FAIL("malloc()");
+
+		strcpy(e->path, ents[i].path);
+		e->rel = e->path + d->root_len + 1;
+		for (char *it = e->path + d->root_len + 1; *it != '\0'; ++ it) {
+			if (*it == '\\')
+				*it = '/';
+		}
 	}
+}
 
-	if (o_files_count == 0)
-		LOG_INFO("Nothing to rebuild");
-	else {
-		if (build_cache_save(&c) != 0)
-			LOG_FATAL("Failed to save build cache");
+static int embed_dir_ent_cmp(const void *a, const void *b) {
+	return strcmp(((const embed_dir_ent_t*)a)->rel, ((const embed_dir_ent_t*)b)->rel);
+}
+
+typedef struct {
+	size_t *keys, count;
+} embed_dir_bucket_t;
 
-		COMPILE(cc, o_files, o_files_count, "-o", out, CARGS, CLIBS);
+static int embed_dir_bucket_cmp(const void *a, const void *b) {
+	size_t ca = ((const embed_dir_bucket_t*)a)->count, cb = ((const embed_dir_bucket_t*)b)->count;
+	return ca < cb? 1 : ca > cb? -1 : 0;
+}
+
+/* Hash and displace: the keys are split into buckets by one hash, and the biggest buckets get a
+   seed for a second hash first, so that all of their keys land in free slots. Lookups then take
+   two hashes and one comparison. slots[i] gets the entry placed at index i */
+static void embed_dir_perfect_hash(embed_dir_ents_t *d, unsigned long *seeds, size_t seeds_count,
+                                   size_t *slots) {
+	embed_dir_bucket_t *buckets = (embed_dir_bucket_t*)calloc(seeds_count, sizeof(*buckets));
+	size_t             *keys    = (size_t*)malloc(d->count * sizeof(*keys));
+	size_t             *tried   = (size_t*)malloc(d->count * sizeof(*tried));
+	bool               *used    = (bool*)calloc(d->count, sizeof(*used));
+	if (buckets == NULL || keys == NULL || tried == NULL || used == NULL)
+		LOG_FAIL("malloc()");
+
+	for (size_t i = 0; i < d->count; ++ i) {
+		d->buf[i].hash = embed_dir_hash(0, d->buf[i].rel);
+		++ buckets[d->buf[i].hash % seeds_count].count;
+	}
+
+	size_t at = 0;
+	for (size_t b = 0; b < seeds_count; ++ b) {
+		buckets[b].keys  = keys + at;
+		at              += buckets[b].count;
+		buckets[b].count = 0;
+	}
 
-		for (size_t i = 0; i < o_files_count; ++ i)
-			free(o_files[i]);
+	for (size_t i = 0; i < d->count; ++ i) {
+		embed_dir_bucket_t *b = &buckets[d->buf[i].hash % seeds_count];
+		b->keys[b->count ++] = i;
 	}
 
+	/* The seeds have to be stored by bucket, so remember where each one came from */
+	for (size_t b = 0; b < seeds_count; ++ b)
+		seeds[b] = b;
+
+	embed_dir_bucket_t *sorted = (embed_dir_bucket_t*)malloc(seeds_count * sizeof(*sorted));
+	if (sorted == NULL)
+		LOG_FAIL("malloc()");
+
+	memcpy(sorted, buckets, seeds_count * sizeof(*sorted));
+	qsort(sorted, seeds_count, sizeof(*sorted), embed_dir_bucket_cmp);
+
+	for (size_t b = 0; b < seeds_count && sorted[b].count > 0; ++ b) {
+		embed_dir_bucket_t *bucket = &sorted[b];
+
+		unsigned long seed = 0;
+		for (;; ++ seed) {
+			if (seed >= EMBED_DIR_MAX_SEED)
+				LOG_FATAL("Failed to find a perfect hash for the embedded directory");
+
+			size_t j = 0;
+			for (; j < bucket->count; ++ j) {
+				tried[j] = embed_dir_hash(seed, d->buf[bucket->keys[j]].rel) % d->count;
+				if (used[tried[j]])
+					break;
+
+				used[tried[j]] = true;
+			}
+
+			if (j == bucket->count)
+				break;
+
+			while (j -- > 0)
+				used[tried[j]] = false;
+		}
+
+		for (size_t j = 0; j < bucket->count; ++ j)
+			slots[tried[j]] = bucket->keys[j];
+
+		seeds[d->buf[bucket->keys[0]].hash % seeds_count] = seed;
+	}
+
+	/* Buckets without keys keep a zero seed */
+	for (size_t b = 0; b < seeds_count; ++ b) {
+		if (buckets[b].count == 0)
+			seeds[b] = 0;
+	}
+
+	free(sorted);
+	free(buckets);
+	free(keys);
+	free(tried);
+	free(used);
+}
+
+static void embed_dir_path_lit(const char *path, embed_out_t *o) {
+	EMBED_WRITE_STR(o, "\"");
+	for (const unsigned char *it = (const unsigned char*)path; *it != '\0'; ++ it) {
+		char *out = embed_reserve(o, 4);
+		if (*it < ' ' || *it > '~' || *it == '"' || *it == '\\' || *it == '?') {
+			/* Always three digits, so a digit after it can not become part of it */
+			out[0] = '\\';
+			out[1] = '0' + (*it >> 6);
+			out[2] = '0' + ((*it >> 3) & 7);
+			out[3] = '0' + (*it & 7);
+			o->len += 4;
+		} else {
+			*out    = (char)*it;
+			o->len += 1;
+		}
+	}
+	EMBED_WRITE_STR(o, "\"");
+}
+
+/* A broken table would only show up when the program runs, so look every file up now */
+static void embed_dir_check(const embed_dir_ents_t *d, const unsigned char *blob,
+                            const unsigned long *seeds, size_t seeds_count, const size_t *slots) {
+	embed_dir_file_t *files = (embed_dir_file_t*)malloc((d->count + 1) * sizeof(*files));
+	if (files == NULL)
+		LOG_FAIL("malloc()");
+
+	for (size_t i = 0; i < d->count; ++ i) {
+		files[i].path   = d->buf[slots[i]].rel;
+		files[i].offset = d->buf[slots[i]].offset;
+		files[i].size   = d->buf[slots[i]].size;
+	}
+
+	for (size_t i = 0; i < d->count; ++ i) {
+		unsigned long found_size = 0;
+		const unsigned char *found = embed_dir_find(blob, files, d->count, seeds, seeds_count,
+		                                            d->buf[i].rel, &found_size);
+		if (found != blob + d->buf[i].offset || found_size != d->buf[i].size)
+			LOG_FAIL("embed_dir_perfect_hash()");
+	}
+
+	free(files);
+}
+
+static void embed_dir_write(embed_out_t *o, const embed_dir_ents_t *d, const unsigned char *blob,
+                            size_t size, const unsigned long *seeds, size_t seeds_count,
+                            const size_t *slots) {
+	EMBED_WRITE_STR(o, "#ifndef EMBED_DIR_DEFINED\n"
+	                   "#\tdefine EMBED_DIR_DEFINED\n"
+	                   "#\tif defined(__GNUC__)\n"
+	                   "#\t\tdefine EMBED_DIR_ALIGNED __attribute__((aligned(16)))\n"
+	                   "#\t\tdefine EMBED_DIR_UNUSED  __attribute__((unused))\n"
+	                   "#\telif defined(_MSC_VER)\n"
+	                   "#\t\tdefine EMBED_DIR_ALIGNED __declspec(align(16))\n"
+	                   "#\t\tdefine EMBED_DIR_UNUSED\n"
+	                   "#\telse\n"
+	                   "#\t\tdefine EMBED_DIR_ALIGNED\n"
+	                   "#\t\tdefine EMBED_DIR_UNUSED\n"
+	                   "#\tendif\n"
+	                   "#\tdefine EMBED_CAT_(A, B) A##B\n"
+	                   "#\tdefine EMBED_CAT(A, B)  EMBED_CAT_(A, B)\n");
+	EMBED_WRITE_STR(o, EMBED_STR(EMBED_DIR_TYPE_SRC) "\n");
+	EMBED_WRITE_STR(o, EMBED_STR(EMBED_DIR_SRC(embed_dir_find, embed_dir_hash,
+	                                           EMBED_DIR_UNUSED)) "\n");
+	EMBED_WRITE_STR(o, "#endif\n\n" EMBED_LIT_PUSH "\n");
+
+	char line[256];
+	int  len = snprintf(line, sizeof(line),
+	                    "EMBED_DIR_ALIGNED static const unsigned char EMBED_NAME[%zu] =\n", size + 1);
+	embed_write(o, line, len);
+	embed_lit(blob != NULL? blob : (const unsigned char*)"", size, o);
+	EMBED_WRITE_STR(o, ";\n\n" EMBED_LIT_POP "\n");
+
+	/* The tables can not be empty */
+	len = snprintf(line, sizeof(line),
+	               "static const embed_dir_file_t EMBED_CAT(EMBED_NAME, _files)[%zu] = {\n",
+	               d->count > 0? d->count : 1);
+	embed_write(o, line, len);
+	if (d->count == 0)
+		EMBED_WRITE_STR(o, "\t{\"\", 0, 0},\n");
+
+	for (size_t i = 0; i < d->count; ++ i) {
+		const embed_dir_ent_t *e = &d->buf[slots[i]];
+
+		EMBED_WRITE_STR(o, "\t{");
+		embed_dir_path_lit(e->rel, o);
+		len = snprintf(line, sizeof(line), ", %luUL, %luUL},\n", e->offset, e->size);
+		embed_write(o, line, len);
+	}
+
+	len = snprintf(line, sizeof(line),
+	               "};\n"
+	               "\n"
+	               "static const unsigned long EMBED_CAT(EMBED_NAME, _seeds)[%zu] = {\n",
+	               seeds_count);
+	embed_write(o, line, len);
+	for (size_t i = 0; i < seeds_count; ++ i) {
+		len = snprintf(line, sizeof(line), "%s%luUL,%s", i % 8 == 0? "\t" : "", seeds[i],
+		               i % 8 == 7 || i + 1 == seeds_count? "\n" : " ");
+		embed_write(o, line, len);
+	}
+
+	EMBED_WRITE_STR(o, "};\n"
+	                   "\n"
+	                   "/* Returns the data of the file at the path relative to the embedded "
+	                   "directory, or NULL if there is none */\n"
+	                   "EMBED_DIR_UNUSED static const unsigned char *EMBED_CAT(EMBED_NAME, _find)"
+	                   "(const char *path, unsigned long *size) {\n");
+	len = snprintf(line, sizeof(line),
+	               "\treturn embed_dir_find(EMBED_NAME, EMBED_CAT(EMBED_NAME, _files), %zuUL,\n"
+	               "\t                      EMBED_CAT(EMBED_NAME, _seeds), %zuUL, path, size);\n",
+	               d->count, seeds_count);
+	embed_write(o, line, len);
+	EMBED_WRITE_STR(o, "}\n"
+	                   "\n"
+	                   "#undef EMBED_NAME\n");
+}
+
+static bool embed_dir_generate(const char *path, const char *out, embed_dir_ents_t *d) {
+	embed_out_t o = {0};
+	o.f = fopen(out, "w");
+	if (o.f == NULL) {
+		LOG_ERROR("Failed to open '%s' to embed '%s' into it", out, path);
+		return false;
+	}
+
+	o.buf = (char*)malloc(EMBED_BUF_SIZE);
+	if (o.buf == NULL)
+		LOG_FAIL("malloc()");
+
+	unsigned char *blob = NULL;
+	size_t         size = 0, cap = 0;
+	bool           ok   = true;
+	for (size_t i = 0; i < d->count; ++ i) {
+		embed_dir_ent_t *e = &d->buf[i];
+
+		fs_map_t m;
+		if (fs_map_file(&m, e->path) != 0) {
+			LOG_ERROR("Failed to open '%s' for embedding", e->path);
+			ok = false;
+			break;
+		}
+
+		e->offset = size;
+		e->size   = (unsigned long)m.size;
+		size     += (m.size / EMBED_DIR_ALIGN + 1) * EMBED_DIR_ALIGN;
+
+		if (size + 1 > cap) {
+			cap = cap == 0? EMBED_BUF_SIZE : cap;
+			while (size + 1 > cap)
+				cap *= 2;
+
+			void *ptr = realloc(blob, cap);
+			if (ptr == NULL)
+				LOG_FAIL("realloc()");
+
+			blob = (unsigned char*)ptr;
+		}
+
+		/* The padding is zeroed, so the output does not depend on leftover memory */
+		memcpy(blob + e->offset, m.data, m.size);
+		memset(blob + e->offset + m.size, 0, size - e->offset - m.size);
+		fs_unmap_file(&m);
+	}
+
+	size_t         seeds_count = d->count / EMBED_DIR_BUCKET_SIZE + 1;
+	unsigned long *seeds       = (unsigned long*)malloc(seeds_count * sizeof(*seeds));
+	size_t        *slots       = (size_t*)malloc((d->count + 1) * sizeof(*slots));
+	if (seeds == NULL || slots == NULL)
+		LOG_FAIL("malloc()");
+
+	if (ok) {
+		embed_dir_perfect_hash(d, seeds, seeds_count, slots);
+		embed_dir_check(d, blob, seeds, seeds_count, slots);
+
+		fprintf(o.f, "/* %s, %zu files */\n", path, d->count);
+		embed_dir_write(&o, d, blob, size, seeds, seeds_count, slots);
+	}
+
+	free(seeds);
+	free(slots);
+	free(blob);
+
+	embed_flush(&o);
+	if (o.failed) {
+		LOG_ERROR("Failed to write '%s'", out);
+		ok = false;
+	}
+
+	free(o.buf);
+	fclose(o.f);
+	return ok;
+}
+
+void embed_dir(const char *path, const char *out) {
+	embed_dir_ents_t d = {0};
+	d.root_len = strlen(path);
+
+	fs_walk_opts_t opts = {0};
+	if (fs_walk(path, &opts, embed_dir_collect, &d) != 0) {
+		LOG_ERROR("Failed to read directory '%s' for embedding", path);
+		return;
+	}
+
+	/* Walk order depends on the file system, keep the output stable */
+	qsort(d.buf, d.count, sizeof(*d.buf), embed_dir_ent_cmp);
+
+	/* Adding, removing or renaming files has to regenerate it too, so the stamp in the cache is a
+	   hash of every path and modification time instead of the newest time */
+	uint64_t stamp = BUILD_HASH_INIT;
+	for (size_t i = 0; i < d.count; ++ i) {
+		int64_t mtime;
+		if (fs_time(d.buf[i].path, &mtime, NULL) != 0)
+			LOG_FATAL("Could not get last modified time of '%s'", d.buf[i].path);
+
+		stamp = build_hash(stamp, d.buf[i].rel, strlen(d.buf[i].rel) + 1);
+		stamp = build_hash_int(stamp, mtime);
+	}
+
+	int64_t stamp_pos = build_stamp(stamp);
+
+	build_cache_t c;
+	if (build_cache_load(&c) != 0)
+		LOG_FATAL("Build cache is corrupted");
+
+	if (build_cache_get(&c, out) != stamp_pos || !fs_exists(out)) {
+		LOG_CUSTOM("EMBED", "Directory '%s' into '%s'", path, out);
+
+		char *tmp = build_path_tmp(out);
+		if (embed_dir_generate(path, tmp, &d))
+			embed_replace(&c, tmp, out, stamp_pos);
+		else
+			fs_remove_file(tmp);
+
+		free(tmp);
+	} else
+		LOG_DEBUG("'%s' is up to date", out);
+
+	build_cache_free(&c);
+
+	for (size_t i = 0; i < d.count; ++ i)
+		free(d.buf[i].path);
+
+	free(d.buf);
+}
+
+static build_cache_item_t *build_cache_add(build_cache_t *c) {
+	++ c->count;
+	if (c->count >= c->size) {
+		c->size *= 2;
+		void *ptr = realloc(c->buf, c->size * sizeof(*c->buf));
+		if (ptr == NULL) {
+			free(c->buf);
+			LOG_FAIL("realloc()");
+		} else
+			c->buf = (build_cache_item_t*)ptr;
+	}
+
+	return &c->buf[c->count - 1];
+}
+
+#ifdef BUILD_PLATFORM_WINDOWS
+typedef HANDLE build_lock_t;
+#else
+typedef int build_lock_t;
+#endif
+
+/* The cache itself gets replaced on every save, so the lock is a separate file that stays */
+static int build_cache_lock(build_lock_t *l, const char *path) {
+	char *lock = build_path_suffix(path, ".lock");
+
+#ifdef BUILD_PLATFORM_WINDOWS
+	*l = CreateFileA(lock, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+	                 OPEN_ALWAYS, 0, NULL);
+	free(lock);
+	if (*l == INVALID_HANDLE_VALUE)
+		return -1;
+
+	OVERLAPPED o = {0};
+	if (!LockFileEx(*l, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &o)) {
+		CloseHandle(*l);
+		return -1;
+	}
+#else
+	*l = open(lock, O_RDWR | O_CREAT, 0644);
+	free(lock);
+	if (*l < 0)
+		return -1;
+
+	while (flock(*l, LOCK_EX) != 0) {
+		if (errno != EINTR) {
+			close(*l);
+			return -1;
+		}
+	}
+#endif
+
+	return 0;
+}
+
+/* Closing the file releases the lock */
+static void build_cache_unlock(build_lock_t l) {
+#ifdef BUILD_PLATFORM_WINDOWS
+	CloseHandle(l);
+#else
+	close(l);
+#endif
+}
+
+static int build_cache_delete_at(const char *path) {
+	build_lock_t l;
+	if (build_cache_lock(&l, path) != 0)
+		return -1;
+
+	int ret = fs_remove_file(path);
+	build_cache_unlock(l);
+	return ret;
+}
+
+int build_cache_delete(void) {
+	return build_cache_delete_at(BUILD_CACHE_PATH);
+}
+
+int build_cache_load(build_cache_t *c) {
+	return build_cache_open(c, BUILD_CACHE_PATH);
+}
+
+int build_cache_open(build_cache_t *c, const char *path) {
+	c->count      = 0;
+	c->size       = 16;
+	c->dirty      = false;
+	c->index      = NULL;
+	c->index_size = 0;
+	c->indexed    = 0;
+	c->path       = FS_JOIN_PATH(path);
+	c->buf        = (build_cache_item_t*)malloc(c->size * sizeof(*c->buf));
+	if (c->buf == NULL || c->path == NULL)
+		LOG_FAIL("malloc()");
+
+	/* No cache yet means that everything has to be built */
+	fs_map_t m;
+	if (fs_map_file(&m, path) != 0)
+		return 0;
+
+	const char *it = m.data, *end = m.data + m.size;
+	while (it < end) {
+		const char *line_end = (const char*)memchr(it, '\n', end - it);
+		if (line_end == NULL)
+			line_end = end;
+
+		const char *quote = *it == '"'? (const char*)memchr(it + 1, '"', line_end - it - 1) : NULL;
+		if (quote == NULL) {
+			fs_unmap_file(&m);
+			return -1;
+		}
+
+		size_t len = quote - it - 1;
+
+		build_cache_item_t *item = build_cache_add(c);
+		item->path = (char*)malloc(len + 1);
+		if (item->path == NULL)
+			LOG_FAIL("malloc()");
+
+		memcpy(item->path, it + 1, len);
+		item->path[len] = '\0';
+		item->dirty     = false;
+
+		int64_t mtime = 0;
+		for (const char *num = quote + 1; num < line_end; ++ num) {
+			if (*num >= '0' && *num <= '9')
+				mtime = mtime * 10 + (*num - '0');
+		}
+		item->mtime = mtime;
+
+		it = line_end + 1;
+	}
+
+	fs_unmap_file(&m);
+	return 0;
+}
+
+static void build_cache_index_insert(build_cache_t *c, size_t idx) {
+	const char *path = c->buf[idx].path;
+
+	size_t mask = c->index_size - 1;
+	size_t i    = build_hash(BUILD_HASH_INIT, path, strlen(path)) & mask;
+	while (c->index[i] != 0)
+		i = (i + 1) & mask;
+
+	c->index[i] = idx + 1;
+}
+
+static void build_cache_index(build_cache_t *c) {
+	if ((c->count + 1) * 4 > c->index_size) {
+		size_t size = c->index_size == 0? 64 : c->index_size;
+		while ((c->count + 1) * 4 > size)
+			size *= 2;
+
+		free(c->index);
+		c->index = (size_t*)calloc(size, sizeof(*c->index));
+		if (c->index == NULL)
+			LOG_FAIL("calloc()");
+
+		c->index_size = size;
+		c->indexed    = 0;
+	}
+
+	for (; c->indexed < c->count; ++ c->indexed)
+		build_cache_index_insert(c, c->indexed);
+}
+
+static build_cache_item_t *build_cache_find(build_cache_t *c, const char *path) {
+	build_cache_index(c);
+
+	size_t mask = c->index_size - 1;
+	for (size_t i = build_hash(BUILD_HASH_INIT, path, strlen(path)) & mask; c->index[i] != 0;
+	     i = (i + 1) & mask) {
+		build_cache_item_t *item = &c->buf[c->index[i] - 1];
+		if (strcmp(item->path, path) == 0)
+			return item;
+	}
+
+	return NULL;
+}
+
+static int build_cache_item_cmp(const void *a, const void *b) {
+	return strcmp(((const build_cache_item_t*)a)->path, ((const build_cache_item_t*)b)->path);
+}
+
+/* Takes the changed entries of c and the rest from disk, which another build may have updated
+   since c was loaded. Both are sorted, so it is a single pass. Entries that are in neither stay
+   dropped, like after a build_clean */
+static void build_cache_merge(build_cache_t *c, build_cache_t *disk) {
+	qsort(c->buf,    c->count,    sizeof(*c->buf),    build_cache_item_cmp);
+	qsort(disk->buf, disk->count, sizeof(*disk->buf), build_cache_item_cmp);
+
+	build_cache_t merged = {0};
+	merged.size = c->count + disk->count + 1;
+	merged.buf  = (build_cache_item_t*)malloc(merged.size * sizeof(*merged.buf));
+	if (merged.buf == NULL)
+		LOG_FAIL("malloc()");
+
+	size_t i = 0, j = 0;
+	while (i < c->count || j < disk->count) {
+		int cmp = i >= c->count? 1 : j >= disk->count? -1 :
+		          strcmp(c->buf[i].path, disk->buf[j].path);
+
+		build_cache_item_t *ours   = cmp <= 0? &c->buf[i ++]    : NULL;
+		build_cache_item_t *theirs = cmp >= 0? &disk->buf[j ++] : NULL;
+
+		build_cache_item_t *keep;
+		if (ours != NULL && ours->dirty) {
+			keep = ours;
+			if (theirs != NULL)
+				free(theirs->path);
+		} else {
+			keep = theirs;
+			if (ours != NULL)
+				free(ours->path);
+		}
+
+		/* A clean entry that is gone from disk was removed by someone else */
+		if (keep == NULL)
+			continue;
+
+		keep->dirty = false;
+		merged.buf[merged.count ++] = *keep;
+	}
+
+	/* The paths were moved into merged or freed, and the index is rebuilt on the next lookup */
+	merged.path = c->path;
+	free(c->index);
+	free(c->buf);
+	free(disk->buf);
+	free(disk->path);
+	*c = merged;
+}
+
+/* The merge happens under the lock, and the result is written next to the cache and renamed
+   over it, so readers never see half of a cache */
+int build_cache_save(build_cache_t *c) {
+	if (!c->dirty)
+		return 0;
+
+	build_lock_t l;
+	if (build_cache_lock(&l, c->path) != 0)
+		return -1;
+
+	build_cache_t disk;
+	if (build_cache_open(&disk, c->path) != 0) {
+		LOG_WARN("Build cache '%s' is corrupted, replacing it", c->path);
+		build_cache_free(&disk);
+	}
+
+	build_cache_merge(c, &disk);
+
+	char *tmp = build_path_suffix(c->path, ".tmp");
+	FILE *f   = fopen(tmp, "w");
+	if (f == NULL) {
+		free(tmp);
+		build_cache_unlock(l);
+		return -1;
+	}
+
+	for (size_t i = 0; i < c->count; ++ i)
+		fprintf(f, "\"%s\" %llu\n", c->buf[i].path, (unsigned long long)c->buf[i].mtime);
+
+	int  ret    = 0;
+	bool failed = ferror(f);
+	if (fclose(f) != 0 || failed || fs_move_file(tmp, c->path) != 0) {
+		fs_remove_file(tmp);
+		ret = -1;
+	}
+
+	free(tmp);
+	build_cache_unlock(l);
+	return ret;
+}
+
+void build_cache_free(build_cache_t *c) {
+	for (size_t i = 0; i < c->count; ++ i)
+		free(c->buf[i].path);
+
+	free(c->buf);
+	free(c->path);
+	free(c->index);
+	c->buf        = NULL;
+	c->path       = NULL;
+	c->index      = NULL;
+	c->count      = 0;
+	c->size       = 0;
+	c->index_size = 0;
+	c->indexed    = 0;
+	c->dirty      = false;
+}
+
+void build_cache_set(build_cache_t *c, const char *path, int64_t mtime) {
+	build_cache_item_t *found = build_cache_find(c, path);
+	if (found != NULL) {
+		if (found->mtime != mtime) {
+			found->mtime = mtime;
+			found->dirty = true;
+			c->dirty     = true;
+		}
+
+		return;
+	}
+
+	build_cache_item_t *item = build_cache_add(c);
+	item->path = (char*)malloc(strlen(path) + 1);
+	if (item->path == NULL)
+		LOG_FAIL("malloc()");
+
+	strcpy(item->path, path);
+	item->mtime = mtime;
+	item->dirty = true;
+	c->dirty    = true;
+}
+
+int64_t build_cache_get(build_cache_t *c, const char *path) {
+	build_cache_item_t *found = build_cache_find(c, path);
+	return found == NULL? (int64_t)-1 : found->mtime;
+}
+
+/* Configuration directories only hold what build() put there */
+static void build_clean_config(const char *dir) {
+	int status;
+	FOREACH_IN_DIR(dir, d, ent, {
+		if (ent.attr & FS_DIR)
+			continue;
+
+		char *path = FS_JOIN_PATH(d.path, ent.name);
+		if (path == NULL)
+			LOG_FAIL("malloc()");
+
+		fs_remove_file(path);
+		free(path);
+	}, status);
+
+	if (status != 0 || fs_remove_dir(dir) != 0)
+		LOG_ERROR("Failed to remove directory '%s'", dir);
+}
+
+void build_clean(const char *path) {
+	bool found = false;
+	int  status;
+	FOREACH_IN_DIR(path, dir, ent, {
+		char *path = FS_JOIN_PATH(dir.path, ent.name);
+		if (path == NULL)
+			LOG_FAIL("malloc()");
+
+		if (ent.attr & FS_DIR && !(ent.attr & FS_HIDDEN)) {
+			char *cache = FS_JOIN_PATH(path, BUILD_CACHE_PATH);
+			if (cache == NULL)
+				LOG_FAIL("malloc()");
+
+			if (fs_exists(cache)) {
+				found = true;
+				build_clean_config(path);
+			}
+
+			free(cache);
+		} else if (strcmp(fs_ext(ent.name), "o") == 0) {
+			found = true;
+			fs_remove_file(path);
+		}
+
+		free(path);
+	}, status);
+
+	if (status != 0)
+		LOG_FATAL("Failed to open directory '%s'", path);
+
+	/* The lock goes too, like those in the configuration directories. A build that is waiting
+	   on it while cleaning would be broken anyway */
+	char *lock = build_path_suffix(BUILD_CACHE_PATH, ".lock");
+	build_cache_delete();
+	if (fs_exists(lock))
+		fs_remove_file(lock);
+
+	free(lock);
+
+	if (!found)
+		LOG_INFO("Nothing to clean");
+	else
+		LOG_INFO("Cleaned '%s'", path);
+}
+
+#ifndef CARGS
+#	define CARGS
+#endif
+
+#ifndef CLIBS
+#	define CLIBS
+#endif
+
+/* C++ sources get the C flags unless they have their own */
+#ifndef CXXARGS
+#	define CXXARGS CARGS
+#endif
+
+/* An empty CARGS or CLIBS leaves a trailing comma, which is fine in an initializer but not in
+   a macro call */
+static const char *_build_cargs[]   = {NULL, CARGS};
+static const char *_build_cxxargs[] = {NULL, CXXARGS};
+static const char *_build_clibs[]   = {NULL, CLIBS};
+
+#define BUILD_ARGS_COUNT(ARR) (sizeof(ARR) / sizeof((ARR)[0]) - 1)
+
+typedef struct {
+	const char  *name, *cc, *cxx;
+	const char **args, **cxx_args;
+	size_t       args_count, cxx_args_count;
+} build_config_t;
+
+static build_config_t *_build_configs       = NULL;
+static size_t          _build_configs_count = 0;
+
+static const char *_build_cxx = CXX;
+
+void build_set_cxx(const char *cxx) {
+	_build_cxx = cxx;
+}
+
+static const char **build_copy_args(const char **args, size_t args_count) {
+	const char **copy = (const char**)malloc((args_count + 1) * sizeof(*copy));
+	if (copy == NULL)
+		LOG_FAIL("malloc()");
+
+	memcpy(copy, args, args_count * sizeof(*args));
+	return copy;
+}
+
+void build_config(const char *name, const char *cc, const char **args, size_t args_count) {
+	void *ptr = realloc(_build_configs, (_build_configs_count + 1) * sizeof(*_build_configs));
+	if (ptr == NULL)
+		LOG_FAIL("realloc()");
+
+	_build_configs = (build_config_t*)ptr;
+
+	build_config_t *cfg = &_build_configs[_build_configs_count ++];
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->name       = name;
+	cfg->cc         = cc;
+	cfg->args       = build_copy_args(args, args_count);
+	cfg->args_count = args_count;
+}
+
+void build_config_cxx(const char *name, const char *cxx, const char **args, size_t args_count) {
+	for (size_t i = 0; i < _build_configs_count; ++ i) {
+		build_config_t *cfg = &_build_configs[i];
+		if (strcmp(cfg->name, name) != 0)
+			continue;
+
+		cfg->cxx            = cxx;
+		cfg->cxx_args       = build_copy_args(args, args_count);
+		cfg->cxx_args_count = args_count;
+		return;
+	}
+
+	LOG_FATAL("Unknown build configuration '%s'", name);
+}
+
+/* Without any registered configurations, cc, the C++ compiler and CARGS and CXXARGS make up the
+   default one. Configurations without their own C++ compiler and flags use the C flags */
+static build_config_t build_select_config(const char *cc) {
+	if (_build_configs_count == 0 && _build_config_name == NULL) {
+		build_config_t cfg = {
+			"default", cc, _build_cxx,
+			_build_cargs + 1, _build_cxxargs + 1,
+			BUILD_ARGS_COUNT(_build_cargs), BUILD_ARGS_COUNT(_build_cxxargs),
+		};
+		return cfg;
+	}
+
+	for (size_t i = 0; i < _build_configs_count; ++ i) {
+		build_config_t cfg = _build_configs[i];
+		if (_build_config_name != NULL && strcmp(cfg.name, _build_config_name) != 0)
+			continue;
+
+		if (cfg.cxx == NULL) {
+			cfg.cxx            = _build_cxx;
+			cfg.cxx_args       = cfg.args;
+			cfg.cxx_args_count = cfg.args_count;
+		}
+
+		return cfg;
+	}
+
+	LOG_FATAL("Unknown build configuration '%s'", _build_config_name);
+	return _build_configs[0];
+}
+
+/* Named after the configuration and a hash of everything that changes its output, so changing
+   the flags of a configuration does not mix objects built with different flags */
+static char *build_config_dir(const build_config_t *cfg, const char *bin) {
+	uint64_t key = build_hash(BUILD_HASH_INIT, cfg->cc, strlen(cfg->cc) + 1);
+	for (size_t i = 0; i < cfg->args_count; ++ i)
+		key = build_hash(key, cfg->args[i], strlen(cfg->args[i]) + 1);
+
+	key = build_hash(key, cfg->cxx, strlen(cfg->cxx) + 1);
+	for (size_t i = 0; i < cfg->cxx_args_count; ++ i)
+		key = build_hash(key, cfg->cxx_args[i], strlen(cfg->cxx_args[i]) + 1);
+
+	/* Through pointers, comparing against the count warns when CLIBS is empty */
+	const char **libs_end = _build_clibs + sizeof(_build_clibs) / sizeof(_build_clibs[0]);
+	for (const char **lib = _build_clibs + 1; lib < libs_end; ++ lib)
+		key = build_hash(key, *lib, strlen(*lib) + 1);
+
+	char name[256];
+	snprintf(name, sizeof(name), "%s-%08lx", cfg->name, (unsigned long)(key & 0xFFFFFFFF));
+
+	char *dir = FS_JOIN_PATH(bin, name);
+	if (dir == NULL)
+		LOG_FAIL("malloc()");
+
+	return dir;
+}
+
+/* Includes of every file that build() reached, looked up by path. The includes are scanned
+   from the sources themselves, so they are known before anything was compiled, and remembered
+   per configuration with the modification time they were scanned at */
+typedef struct {
+	char   *path;
+	int64_t mtime;      /* Of this run, -1 if the file is missing */
+	int64_t scanned_at; /* -1 if the includes are not known */
+	size_t *deps;       /* Indices of the included files */
+	size_t  deps_count;
+	char   *module;     /* C++ module (or partition) it is the interface of */
+	char  **imports;    /* Names of the imported modules */
+	size_t  imports_count;
+	char  **missing;    /* Includes that were not found, after a '"' or '<' */
+	size_t  missing_count;
+	size_t  seen;       /* Last traversal that reached it */
+	size_t  job;        /* Index + 1 of the job building it, 0 if none */
+	bool    has_mtime;
+} build_dep_t;
+
+typedef struct {
+	const char *name;
+	size_t      file;
+} build_module_t;
+
+typedef struct {
+	build_dep_t    *buf;
+	size_t          count, size;
+	size_t         *index;   /* Open addressing, i + 1 refers to buf[i] */
+	size_t          index_size;
+	const char    **dirs;    /* Include search paths from the flags */
+	size_t          dirs_count;
+	build_module_t *modules; /* Sorted by name */
+	size_t          modules_count;
+	size_t          traversal;
+	bool            dirty;
+	char           *path;
+} build_deps_t;
+
+static size_t *build_deps_slot(build_deps_t *d, const char *path, size_t len) {
+	size_t mask = d->index_size - 1;
+	for (size_t i = build_hash(BUILD_HASH_INIT, path, len) & mask; ; i = (i + 1) & mask) {
+		size_t *slot = &d->index[i];
+		if (*slot == 0 || (strncmp(d->buf[*slot - 1].path, path, len) == 0 &&
+		                   d->buf[*slot - 1].path[len] == '\0'))
+			return slot;
+	}
+}
+
+static size_t build_deps_add(build_deps_t *d, const char *path, size_t len) {
+	if (d->count * 2 >= d->index_size) {
+		d->index_size = d->index_size == 0? 256 : d->index_size * 2;
+		free(d->index);
+		d->index = (size_t*)calloc(d->index_size, sizeof(*d->index));
+		if (d->index == NULL)
+			LOG_FAIL("calloc()");
+
+		for (size_t i = 0; i < d->count; ++ i)
+			*build_deps_slot(d, d->buf[i].path, strlen(d->buf[i].path)) = i + 1;
+	}
+
+	size_t *slot = build_deps_slot(d, path, len);
+	if (*slot != 0)
+		return *slot - 1;
+
+	if (d->count >= d->size) {
+		d->size = d->size == 0? 256 : d->size * 2;
+		void *ptr = realloc(d->buf, d->size * sizeof(*d->buf));
+		if (ptr == NULL)
+			LOG_FAIL("realloc()");
+
+		d->buf = (build_dep_t*)ptr;
+	}
+
+	build_dep_t *dep = &d->buf[d->count];
+	memset(dep, 0, sizeof(*dep));
+	dep->scanned_at = -1;
+	dep->path       = (char*)malloc(len + 1);
+	if (dep->path == NULL)
+		LOG_FAIL("malloc()");
+
+	memcpy(dep->path, path, len);
+	dep->path[len] = '\0';
+
+	*slot = ++ d->count;
+	return d->count - 1;
+}
+
+/* The modification time is read once per run */
+static int64_t build_deps_mtime(build_deps_t *d, size_t i) {
+	build_dep_t *dep = &d->buf[i];
+	if (!dep->has_mtime) {
+		if (fs_time(dep->path, &dep->mtime, NULL) != 0)
+			dep->mtime = -1;
+
+		dep->has_mtime = true;
+	}
+
+	return dep->mtime;
+}
+
+static void build_deps_push(build_dep_t *dep, size_t i) {
+	for (size_t j = 0; j < dep->deps_count; ++ j) {
+		if (dep->deps[j] == i)
+			return;
+	}
+
+	void *ptr = realloc(dep->deps, (dep->deps_count + 1) * sizeof(*dep->deps));
+	if (ptr == NULL)
+		LOG_FAIL("realloc()");
+
+	dep->deps = (size_t*)ptr;
+	dep->deps[dep->deps_count ++] = i;
+}
+
+static char *build_strndup(const char *str, size_t len) {
+	char *copy = (char*)malloc(len + 1);
+	if (copy == NULL)
+		LOG_FAIL("malloc()");
+
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+	return copy;
+}
+
+static void build_deps_import(build_dep_t *dep, const char *name, size_t len) {
+	void *ptr = realloc(dep->imports, (dep->imports_count + 1) * sizeof(*dep->imports));
+	if (ptr == NULL)
+		LOG_FAIL("realloc()");
+
+	dep->imports = (char**)ptr;
+	dep->imports[dep->imports_count ++] = build_strndup(name, len);
+}
+
+static void build_deps_missing(build_dep_t *dep, const char *name, size_t len, bool quoted) {
+	void *ptr = realloc(dep->missing, (dep->missing_count + 1) * sizeof(*dep->missing));
+	if (ptr == NULL)
+		LOG_FAIL("realloc()");
+
+	char *str = (char*)malloc(len + 2);
+	if (str == NULL)
+		LOG_FAIL("malloc()");
+
+	str[0] = quoted? '"' : '<';
+	memcpy(str + 1, name, len);
+	str[len + 1] = '\0';
+
+	dep->missing = (char**)ptr;
+	dep->missing[dep->missing_count ++] = str;
+}
+
+static void build_deps_add_dirs(build_deps_t *d, const char **args, size_t args_count) {
+	for (size_t i = 0; i < args_count; ++ i) {
+		const char *arg = args[i], *dir = NULL;
+		if (strcmp(arg, "-I") == 0 || strcmp(arg, "-iquote") == 0 || strcmp(arg, "-isystem") == 0) {
+			if (i + 1 < args_count)
+				dir = args[++ i];
+		} else if (strncmp(arg, "-I", 2) == 0)
+			dir = arg + 2;
+
+		for (size_t j = 0; dir != NULL && j < d->dirs_count; ++ j) {
+			if (strcmp(d->dirs[j], dir) == 0)
+				dir = NULL;
+		}
+
+		if (dir != NULL)
+			d->dirs[d->dirs_count ++] = dir;
+	}
+}
+
+/* Whether the text between two tokens ends with a word */
+static bool build_ends_with(const char *it, const char *end, const char *word) {
+	while (end > it && (end[-1] == ' ' || end[-1] == '\t'))
+		-- end;
+
+	size_t len = strlen(word);
+	return (size_t)(end - it) >= len && memcmp(end - len, word, len) == 0;
+}
+
+/* Each line is a file, the modification time its includes were scanned at and the includes,
+   followed by the module it provides, the modules it imports and the includes not found */
+static void build_deps_open(build_deps_t *d, const char *path, const build_config_t *cfg) {
+	memset(d, 0, sizeof(*d));
+	d->path = FS_JOIN_PATH(path);
+	d->dirs = (const char**)malloc((cfg->args_count + cfg->cxx_args_count + 1) * sizeof(*d->dirs));
+	if (d->path == NULL || d->dirs == NULL)
+		LOG_FAIL("malloc()");
+
+	build_deps_add_dirs(d, cfg->args,     cfg->args_count);
+	build_deps_add_dirs(d, cfg->cxx_args, cfg->cxx_args_count);
+
+	fs_map_t m;
+	if (fs_map_file(&m, path) != 0)
+		return;
+
+	const char *it = m.data, *end = m.data + m.size;
+	while (it < end) {
+		const char *line_end = (const char*)memchr(it, '\n', end - it);
+		if (line_end == NULL)
+			line_end = end;
+
+		size_t file = (size_t)-1;
+		for (const char *quote = it, *prev = it; quote < line_end; prev = quote) {
+			quote = (const char*)memchr(quote, '"', line_end - quote);
+			if (quote == NULL)
+				break;
+
+			const char *close = (const char*)memchr(quote + 1, '"', line_end - quote - 1);
+			if (close == NULL)
+				break;
+
+			size_t len = close - quote - 1;
+			if (file == (size_t)-1) {
+				file = build_deps_add(d, quote + 1, len);
+
+				int64_t mtime = 0;
+				for (const char *num = close + 1; num < line_end && *num != '"'; ++ num) {
+					if (*num >= '0' && *num <= '9')
+						mtime = mtime * 10 + (*num - '0');
+				}
+				d->buf[file].scanned_at = mtime;
+			} else if (build_ends_with(prev, quote, "module")) {
+				free(d->buf[file].module);
+				d->buf[file].module = build_strndup(quote + 1, len);
+			} else if (build_ends_with(prev, quote, "import"))
+				build_deps_import(&d->buf[file], quote + 1, len);
+			else if (build_ends_with(prev, quote, "missing"))
+				build_deps_missing(&d->buf[file], quote + 1, len, true);
+			else if (build_ends_with(prev, quote, "system"))
+				build_deps_missing(&d->buf[file], quote + 1, len, false);
+			else {
+				size_t i = build_deps_add(d, quote + 1, len);
+				build_deps_push(&d->buf[file], i);
+			}
+
+			quote = close + 1;
+		}
+
+		it = line_end + 1;
+	}
+
+	fs_unmap_file(&m);
+}
+
+/* The deps file is only a hint, since every entry is checked against the modification time of
+   its file, so builds running at the same time each write their own temporary file and the last
+   rename wins. Failing to save it only costs a rescan */
+static void build_deps_save(build_deps_t *d) {
+	if (!d->dirty)
+		return;
+
+	char *tmp = build_path_tmp(d->path);
+	FILE *f   = fopen(tmp, "w");
+	if (f == NULL) {
+		LOG_WARN("Failed to save '%s'", d->path);
+		free(tmp);
+		return;
+	}
+
+	for (size_t i = 0; i < d->count; ++ i) {
+		build_dep_t *dep = &d->buf[i];
+		if (dep->scanned_at < 0)
+			continue;
+
+		fprintf(f, "\"%s\" %llu", dep->path, (unsigned long long)dep->scanned_at);
+		for (size_t j = 0; j < dep->deps_count; ++ j)
+			fprintf(f, " \"%s\"", d->buf[dep->deps[j]].path);
+
+		if (dep->module != NULL)
+			fprintf(f, " module \"%s\"", dep->module);
+
+		for (size_t j = 0; j < dep->imports_count; ++ j)
+			fprintf(f, " import \"%s\"", dep->imports[j]);
+
+		for (size_t j = 0; j < dep->missing_count; ++ j)
+			fprintf(f, " %s \"%s\"", dep->missing[j][0] == '"'? "missing" : "system",
+			        dep->missing[j] + 1);
+
+		fputc('\n', f);
+	}
+
+	bool failed = ferror(f);
+	if (fclose(f) != 0 || failed || fs_move_file(tmp, d->path) != 0) {
+		fs_remove_file(tmp);
+		LOG_WARN("Failed to save '%s'", d->path);
+	} else
+		d->dirty = false;
+
+	free(tmp);
+}
+
+/* Forgets what a scan found besides the includes */
+static void build_deps_clear(build_dep_t *dep) {
+	for (size_t i = 0; i < dep->imports_count; ++ i)
+		free(dep->imports[i]);
+
+	for (size_t i = 0; i < dep->missing_count; ++ i)
+		free(dep->missing[i]);
+
+	free(dep->imports);
+	free(dep->missing);
+	free(dep->module);
+	dep->imports       = NULL;
+	dep->imports_count = 0;
+	dep->missing       = NULL;
+	dep->missing_count = 0;
+	dep->module        = NULL;
+}
+
+static void build_deps_free(build_deps_t *d) {
+	for (size_t i = 0; i < d->count; ++ i) {
+		free(d->buf[i].path);
+		free(d->buf[i].deps);
+		build_deps_clear(&d->buf[i]);
+	}
+
+	free(d->buf);
+	free(d->index);
+	free(d->dirs);
+	free(d->modules);
+	free(d->path);
+	memset(d, 0, sizeof(*d));
+}
+
+/* Quoted includes are looked for next to the file first, then both kinds in the include paths.
+   Returns the index of the file that was found, -1 if none was */
+static size_t build_deps_resolve(build_deps_t *d, size_t file, const char *name, size_t len,
+                                 bool quoted) {
+	const char *from     = d->buf[file].path;
+	size_t      from_dir = fs_basename(from) - from;
+
+	char path[4096];
+	for (size_t i = quoted? 0 : 1; i <= d->dirs_count; ++ i) {
+		int n = i == 0? snprintf(path, sizeof(path), "%.*s%.*s", (int)from_dir, from, (int)len, name) :
+		        snprintf(path, sizeof(path), "%s/%.*s", d->dirs[i - 1], (int)len, name);
+		if (n < 0 || (size_t)n >= sizeof(path))
+			continue;
+
+		size_t dep = build_deps_add(d, path, n);
+		if (build_deps_mtime(d, dep) >= 0)
+			return dep;
+	}
+
+	return (size_t)-1;
+}
+
+static bool build_is_space(char ch) {
+	return ch == ' ' || ch == '\t';
+}
+
+/* Which compiler builds a source, by its extension */
+enum {
+	BUILD_LANG_NONE = 0,
+	BUILD_LANG_C,
+	BUILD_LANG_CXX,
+};
+
+static int build_lang(const char *path) {
+	const char *ext = fs_ext(path);
+	if (strcmp(ext, "c") == 0)
+		return BUILD_LANG_C;
+	else if (strcmp(ext, "cc") == 0 || strcmp(ext, "cpp") == 0 || strcmp(ext, "cxx") == 0)
+		return BUILD_LANG_CXX;
+	else
+		return BUILD_LANG_NONE;
+}
+
+static bool build_is_name(char ch) {
+	return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') ||
+	       ch == '_' || ch == '.' || ch == ':';
+}
+
+/* Skips a keyword and the whitespace after it, NULL if it is not there */
+static const char *build_skip_word(const char *it, const char *end, const char *word) {
+	size_t len = strlen(word);
+	if ((size_t)(end - it) < len || memcmp(it, word, len) != 0)
+		return NULL;
+
+	it += len;
+	if (it < end && build_is_name(*it) && *it != ':')
+		return NULL;
+
+	while (it < end && build_is_space(*it))
+		++ it;
+
+	return it;
+}
+
+/* Module declarations and imports have to come before any other declaration, so only the start
+   of a C++ source is read, skipping lines of the preprocessor and comments */
+static void build_deps_scan_modules(build_dep_t *dep, const char *it, const char *end) {
+	const char *base     = NULL; /* Module of the file, which its partitions belong to */
+	size_t      base_len = 0;
+	bool        comment  = false;
+	while (it < end) {
+		const char *line_end = (const char*)memchr(it, '\n', end - it);
+		if (line_end == NULL)
+			line_end = end;
+
+		const char *line = it;
+		it = line_end + 1;
+
+		while (line < line_end && build_is_space(*line))
+			++ line;
+
+		if (!comment && line_end - line >= 2 && line[0] == '/' && line[1] == '*') {
+			comment = true;
+			line   += 2;
+		}
+
+		if (comment) {
+			for (; line + 1 < line_end && comment; ++ line)
+				comment = line[0] != '*' || line[1] != '/';
+
+			continue;
+		}
+
+		if (line == line_end || *line == '#' || *line == '\r' ||
+		    (line_end - line >= 2 && line[0] == '/' && line[1] == '/'))
+			continue;
+
+		const char *next     = build_skip_word(line, line_end, "export");
+		bool        exported = next != NULL;
+		if (exported)
+			line = next;
+
+		bool is_import = false;
+		if ((next = build_skip_word(line, line_end, "module")) == NULL) {
+			if ((next = build_skip_word(line, line_end, "import")) == NULL)
+				break;
+
+			is_import = true;
+		}
+
+		const char *name = next;
+		while (next < line_end && build_is_name(*next))
+			++ next;
+
+		/* The global module fragment, the private one and header units name no module */
+		size_t len = next - name;
+		if (len == 0 || (!is_import && *name == ':'))
+			continue;
+
+		if (!is_import) {
+			const char *colon = (const char*)memchr(name, ':', len);
+			base     = name;
+			base_len = colon == NULL? len : (size_t)(colon - name);
+
+			/* Interfaces and partitions are imported by others, an implementation imports the
+			   interface of its module */
+			if (exported || colon != NULL) {
+				free(dep->module);
+				dep->module = build_strndup(name, len);
+			} else
+				build_deps_import(dep, name, len);
+		} else if (*name == ':') {
+			if (base == NULL)
+				continue;
+
+			char *full = (char*)malloc(base_len + len + 1);
+			if (full == NULL)
+				LOG_FAIL("malloc()");
+
+			memcpy(full, base, base_len);
+			memcpy(full + base_len, name, len);
+			build_deps_import(dep, full, base_len + len);
+			free(full);
+		} else
+			build_deps_import(dep, name, len);
+	}
+}
+
+/* memchr jumps straight to the next '#', which only starts a directive when nothing but
+   whitespace comes before it on its line. Includes in comments or disabled code are kept,
+   which at worst rebuilds a file too often */
+static void build_deps_scan(build_deps_t *d, size_t file) {
+	build_dep_t *dep = &d->buf[file];
+	dep->deps_count = 0;
+	dep->scanned_at = dep->mtime;
+	d->dirty        = true;
+	build_deps_clear(dep);
+
+	fs_map_t m;
+	if (dep->mtime < 0 || fs_map_file(&m, dep->path) != 0)
+		return;
+
+	if (build_lang(dep->path) == BUILD_LANG_CXX)
+		build_deps_scan_modules(dep, m.data, m.data + m.size);
+
+	const char *it = m.data, *end = m.data + m.size;
+	while ((it = (const char*)memchr(it, '#', end - it)) != NULL) {
+		const char *start = it ++;
+		while (start > m.data && build_is_space(start[-1]))
+			-- start;
+
+		if (start > m.data && start[-1] != '\n')
+			continue;
+
+		while (it < end && build_is_space(*it))
+			++ it;
+
+		if (end - it < 7 || memcmp(it, "include", 7) != 0)
+			continue;
+
+		it += 7;
+		while (it < end && build_is_space(*it))
+			++ it;
+
+		if (it >= end || (*it != '"' && *it != '<'))
+			continue;
+
+		bool        quoted = *it ++ == '"';
+		const char *close  = it;
+		while (close < end && *close != (quoted? '"' : '>') && *close != '\n')
+			++ close;
+
+		/* An include that is not found is remembered, unless nothing could ever provide it, like
+		   a system header without include paths */
+		if (close < end && *close != '\n' && close > it) {
+			size_t dep = build_deps_resolve(d, file, it, close - it, quoted);
+			if (dep != (size_t)-1)
+				build_deps_push(&d->buf[file], dep);
+			else if (quoted || d->dirs_count > 0)
+				build_deps_missing(&d->buf[file], it, close - it, quoted);
+		}
+
+		it = close;
+	}
+
+	fs_unmap_file(&m);
+}
+
+static int build_module_cmp(const void *a, const void *b) {
+	return strcmp(((const build_module_t*)a)->name, ((const build_module_t*)b)->name);
+}
+
+/* Source that provides a module, modules from elsewhere like the standard library are not
+   tracked */
+static size_t build_deps_provider(build_deps_t *d, const char *name) {
+	build_module_t  key   = {name, 0};
+	build_module_t *found = (build_module_t*)bsearch(&key, d->modules, d->modules_count,
+	                                                 sizeof(*d->modules), build_module_cmp);
+	return found == NULL? (size_t)-1 : found->file;
+}
+
+/* Hashes the path and modification time of every file the file includes, directly or not, so
+   the stamp changes when any of them does. Files are rescanned when they changed */
+static void build_deps_walk(build_deps_t *d, size_t file, uint64_t *stamp) {
+	build_dep_t *dep = &d->buf[file];
+	if (dep->seen == d->traversal)
+		return;
+
+	dep->seen = d->traversal;
+
+	int64_t mtime = build_deps_mtime(d, file);
+	if (dep->scanned_at != mtime)
+		build_deps_scan(d, file);
+
+	*stamp = build_hash(*stamp, d->buf[file].path, strlen(d->buf[file].path) + 1);
+	*stamp = build_hash_int(*stamp, mtime);
+
+	/* Scanning can add files and move the buffer */
+	for (size_t i = 0; i < d->buf[file].deps_count; ++ i)
+		build_deps_walk(d, d->buf[file].deps[i], stamp);
+
+	/* Includes that were not found are looked for again, they may have been created since. Every
+	   path is checked once per run */
+	for (size_t i = 0; i < d->buf[file].missing_count; ++ i) {
+		const char *name = d->buf[file].missing[i];
+		size_t      dep  = build_deps_resolve(d, file, name + 1, strlen(name + 1), name[0] == '"');
+		if (dep != (size_t)-1)
+			build_deps_walk(d, dep, stamp);
+	}
+
+	/* A source is rebuilt with the interfaces of the modules it imports */
+	for (size_t i = 0; i < d->buf[file].imports_count; ++ i) {
+		size_t provider = build_deps_provider(d, d->buf[file].imports[i]);
+		if (provider != (size_t)-1)
+			build_deps_walk(d, provider, stamp);
+	}
+}
+
+/* Reads what a source includes and what modules it provides and imports, if it changed */
+static size_t build_deps_source(build_deps_t *d, const char *src) {
+	size_t file = build_deps_add(d, src, strlen(src));
+	if (build_deps_mtime(d, file) < 0)
+		LOG_FATAL("Could not get last modified time of '%s'", src);
+
+	if (d->buf[file].scanned_at != d->buf[file].mtime)
+		build_deps_scan(d, file);
+
+	return file;
+}
+
+/* Called with the sources of the build, once all of them were read */
+static void build_deps_index_modules(build_deps_t *d, const size_t *files, size_t count) {
+	d->modules = (build_module_t*)malloc((count + 1) * sizeof(*d->modules));
+	if (d->modules == NULL)
+		LOG_FAIL("malloc()");
+
+	for (size_t i = 0; i < count; ++ i) {
+		if (d->buf[files[i]].module == NULL)
+			continue;
+
+		build_module_t *m = &d->modules[d->modules_count ++];
+		m->name = d->buf[files[i]].module;
+		m->file = files[i];
+	}
+
+	qsort(d->modules, d->modules_count, sizeof(*d->modules), build_module_cmp);
+	for (size_t i = 1; i < d->modules_count; ++ i) {
+		if (strcmp(d->modules[i - 1].name, d->modules[i].name) == 0)
+			LOG_FATAL("Module '%s' is provided by both '%s' and '%s'", d->modules[i].name,
+			          d->buf[d->modules[i - 1].file].path, d->buf[d->modules[i].file].path);
+	}
+}
+
+static int64_t build_deps_stamp(build_deps_t *d, size_t file) {
+	++ d->traversal;
+
+	uint64_t stamp = BUILD_HASH_INIT;
+	build_deps_walk(d, file, &stamp);
+	return build_stamp(stamp);
+}
+
+/* Compiles a source that changed. Jobs are run at the same time, except that a job waits for
+   the jobs that build the modules its source imports */
+typedef struct {
+	const char    **argv;
+	const char     *src;
+	int64_t         stamp;
+	char           *rss_key; /* Where the cache keeps its peak memory use */
+	int64_t         rss;     /* Peak resident KiB of the last compile, -1 if unknown */
+	size_t         *dependents; /* Jobs waiting for this one */
+	size_t          dependents_count;
+	size_t          waits;      /* Unfinished jobs this one waits for */
+	pid_t           pid;
+	struct timespec start;
+} build_job_t;
+
+static void build_job_new(build_job_t *jobs, size_t *count, build_cache_t *c,
+                          const char *compiler, const char *src, const char *out,
+                          const char **args, size_t args_count, int64_t stamp) {
+	build_job_t *job = &jobs[(*count) ++];
+	memset(job, 0, sizeof(*job));
+	job->src     = src;
+	job->stamp   = stamp;
+	job->rss_key = build_path_suffix(src, ":rss");
+	job->rss     = build_cache_get(c, job->rss_key);
+	job->argv    = (const char**)malloc((args_count + 6) * sizeof(*job->argv));
+	if (job->argv == NULL)
+		LOG_FAIL("malloc()");
+
+	job->argv[0] = compiler;
+	job->argv[1] = "-c";
+	job->argv[2] = src;
+	job->argv[3] = "-o";
+	job->argv[4] = out;
+	memcpy(job->argv + 5, args, args_count * sizeof(*args));
+	job->argv[args_count + 5] = NULL;
+}
+
+static void build_job_wait_for(build_job_t *jobs, size_t job, size_t dependency) {
+	build_job_t *d   = &jobs[dependency];
+	void        *ptr = realloc(d->dependents, (d->dependents_count + 1) * sizeof(*d->dependents));
+	if (ptr == NULL)
+		LOG_FAIL("realloc()");
+
+	d->dependents = (size_t*)ptr;
+	d->dependents[d->dependents_count ++] = job;
+	++ jobs[job].waits;
+}
+
+static size_t build_jobs_max(void) {
+	if (_build_jobs > 0)
+		return _build_jobs;
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return cpus > 0? (size_t)cpus : 1;
+}
+
+/* MemAvailable of /proc/meminfo in KiB, -1 where there is none */
+static int64_t build_mem_available(void) {
+	FILE *f = fopen("/proc/meminfo", "r");
+	if (f == NULL)
+		return -1;
+
+	char      line[256];
+	long long kib = -1;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "MemAvailable: %lld kB", &kib) == 1)
+			break;
+	}
+
+	fclose(f);
+	return kib;
+}
+
+/* A job needs the memory its compile peaked at last time. It has to fit into what is available
+   now, and together with the running jobs, which may still be growing to their peaks, into what
+   was available before they started */
+static bool build_can_start(const build_job_t *job, int64_t reserved, int64_t mem_start) {
+	double load;
+	if (_build_max_load > 0 && getloadavg(&load, 1) == 1 && load >= _build_max_load)
+		return false;
+
+	if (_build_memory > 0 && reserved + job->rss > (int64_t)_build_memory * 1024)
+		return false;
+
+	int64_t mem = build_mem_available();
+	return mem < 0 || mem_start < 0 || (job->rss <= mem && reserved + job->rss <= mem_start);
+}
+
+/* Unknown files are expected to need as much as the hungriest one that is known */
+static void build_jobs_estimate(build_job_t *jobs, size_t count) {
+	int64_t max = 0;
+	for (size_t i = 0; i < count; ++ i) {
+		if (jobs[i].rss > max)
+			max = jobs[i].rss;
+	}
+
+	for (size_t i = 0; i < count; ++ i) {
+		if (jobs[i].rss < 0)
+			jobs[i].rss = max;
+	}
+}
+
+/* Sources that compiled are recorded in the cache right away, with the peak memory use of the
+   compile. After a failure the running jobs are waited for, but no new ones are started. Jobs
+   are delayed while the load or memory does not allow more, but one always runs. Returns
+   whether all of them compiled */
+static bool build_run_jobs(build_job_t *jobs, size_t count, build_cache_t *c) {
+	size_t  max     = build_jobs_max();
+	size_t *ready   = (size_t*)malloc((count + 1) * sizeof(*ready));
+	size_t *running = (size_t*)malloc(max * sizeof(*running));
+	if (ready == NULL || running == NULL)
+		LOG_FAIL("malloc()");
+
+	size_t ready_start = 0, ready_end = 0, running_count = 0, done = 0;
+	for (size_t i = 0; i < count; ++ i) {
+		if (jobs[i].waits == 0)
+			ready[ready_end ++] = i;
+	}
+
+	build_jobs_estimate(jobs, count);
+
+	int64_t mem_start = build_mem_available(), reserved = 0;
+	bool    failed    = false;
+	for (;;) {
+		bool delayed = false;
+		while (!failed && running_count < max && ready_start < ready_end) {
+			build_job_t *job = &jobs[ready[ready_start]];
+			if (running_count > 0 && !build_can_start(job, reserved, mem_start)) {
+				delayed = true;
+				break;
+			}
+
+			job->pid  = cmd_start(job->argv, &job->start);
+			reserved += job->rss;
+			running[running_count ++] = ready[ready_start ++];
+		}
+
+		if (running_count == 0)
+			break;
+
+		/* A delayed job is retried as the load and memory change, not only when one finishes */
+		int           status;
+		struct rusage usage;
+		pid_t         pid = wait4(-1, &status, delayed? WNOHANG : 0, &usage);
+		if (pid == 0) {
+			struct timespec delay = {0, 100 * 1000 * 1000};
+			nanosleep(&delay, NULL);
+			continue;
+		} else if (pid == -1) {
+			if (errno == EINTR)
+				continue;
+
+			LOG_FAIL("wait4()");
+		}
+
+		size_t i = 0;
+		while (i < running_count && jobs[running[i]].pid != pid)
+			++ i;
+
+		if (i == running_count)
+			continue;
+
+		build_job_t *job = &jobs[running[i]];
+		running[i] = running[-- running_count];
+		reserved  -= job->rss;
+		++ done;
+
+		if (cmd_end(job->argv, pid, status, &job->start, LOG_LEVEL_ERROR) != 0) {
+			failed = true;
+			continue;
+		}
+
+#ifdef BUILD_PLATFORM_APPLE
+		int64_t rss = (int64_t)usage.ru_maxrss / 1024; /* In bytes instead of KiB */
+#else
+		int64_t rss = (int64_t)usage.ru_maxrss;
+#endif
+
+		build_cache_set(c, job->src,     job->stamp);
+		build_cache_set(c, job->rss_key, rss);
+		for (size_t j = 0; j < job->dependents_count; ++ j) {
+			if (-- jobs[job->dependents[j]].waits == 0)
+				ready[ready_end ++] = job->dependents[j];
+		}
+	}
+
+	if (!failed && done < count)
+		LOG_ERROR("Modules import each other in a cycle");
+
+	free(ready);
+	free(running);
+	return done == count && !failed;
+}
+
+/* Any C++ object needs the C++ compiler to link in its runtime */
+static void build_link(const build_config_t *cfg, char **o_files, size_t o_files_count,
+                       const char *out, bool cxx) {
+	const char **cfg_args  = cxx? cfg->cxx_args       : cfg->args;
+	size_t       cfg_count = cxx? cfg->cxx_args_count : cfg->args_count;
+	size_t       count     = 2 + cfg_count + BUILD_ARGS_COUNT(_build_clibs);
+	const char **args      = (const char**)malloc(count * sizeof(*args));
+	if (args == NULL)
+		LOG_FAIL("malloc()");
+
+	args[0] = "-o";
+	args[1] = out;
+	memcpy(args + 2, cfg_args, cfg_count * sizeof(*args));
+	memcpy(args + 2 + cfg_count, _build_clibs + 1, BUILD_ARGS_COUNT(_build_clibs) * sizeof(*args));
+
+	compile(cxx? cfg->cxx : cfg->cc, (const char**)o_files, o_files_count, args, count);
+	free(args);
+}
+
+/* out is a copy of the binary of the configuration that was published last, which the cache in
+   the working directory remembers. Returns whether it had to be copied */
+static bool build_publish(const char *dir, const char *linked, const char *out, bool relinked) {
+	build_cache_t c;
+	if (build_cache_load(&c) != 0)
+		LOG_FATAL("Build cache is corrupted");
+
+	int64_t stamp  = build_stamp(build_hash(BUILD_HASH_INIT, dir, strlen(dir)));
+	bool    copied = relinked || build_cache_get(&c, out) != stamp || !fs_exists(out);
+	if (copied) {
+		LOG_CUSTOM("COPY", "'%s' to '%s'", linked, out);
+
+		/* Through a temporary file of its own, so a running copy of out or another configuration
+		   copying at the same time never sees half of a binary */
+		char *tmp = build_path_tmp(out);
+		if (fs_copy_file(linked, tmp) != 0 || fs_move_file(tmp, out) != 0) {
+			fs_remove_file(tmp);
+			LOG_FATAL("Failed to copy '%s' to '%s'", linked, out);
+		}
+
+		free(tmp);
+
+		build_cache_set(&c, out, stamp);
+		if (build_cache_save(&c) != 0)
+			LOG_FATAL("Failed to save build cache");
+	} else
+		LOG_DEBUG("'%s' is up to date", out);
+
+	build_cache_free(&c);
+	return copied;
+}
+
+typedef struct {
+	char *path, *out_name;
+} build_src_t;
+
+typedef struct {
+	build_src_t *buf;
+	size_t       count, size;
+} build_srcs_t;
+
+static void build_collect(const fs_walk_ent_t *ents, size_t count, void *data) {
+	build_srcs_t *srcs = (build_srcs_t*)data;
+
+	for (size_t i = 0; i < count; ++ i) {
+		const fs_walk_ent_t *e = &ents[i];
+
+		if (srcs->count >= srcs->size) {
+			srcs->size = srcs->size == 0? 64 : srcs->size * 2;
+			void *ptr = realloc(srcs->buf, srcs->size * sizeof(*srcs->buf));
+			if (ptr == NULL)
+				LOG_FAIL("realloc()");
+
+			srcs->buf = (build_src_t*)ptr;
+		}
+
+		/* Name the object after the path inside of the walked directory, so sources with the same
+		   name in different subdirectories do not overwrite each others objects */
+		const char *rel = e->name;
+		for (size_t depth = 0; depth < e->depth && rel > e->path; ++ depth) {
+			for (rel -= 2; rel > e->path && rel[-1] != '/' && rel[-1] != '\\'; -- rel);
+		}
+
+		/* C++ objects keep the extension, a C and a C++ source of the same name are common */
+		build_src_t *src = &srcs->buf[srcs->count ++];
+		src->path     = (char*)malloc(strlen(e->path) + 1);
+		src->out_name = build_lang(rel) == BUILD_LANG_CXX? build_path_suffix(rel, ".o") :
+		                fs_replace_ext(rel, "o");
+		if (src->path == NULL || src->out_name == NULL)
+			LOG_FAIL("malloc()");
+
+		strcpy(src->path, e->path);
+		for (char *it = src->out_name; *it != '\0'; ++ it) {
+			if (*it == '/' || *it == '\\')
+				*it = '_';
+		}
+	}
+}
+
+static int build_src_cmp(const void *a, const void *b) {
+	return strcmp(((const build_src_t*)a)->path, ((const build_src_t*)b)->path);
+}
+
+static bool build_is_glob(const char *src) {
+	return src[0] == '!' || strpbrk(src, "*?[{") != NULL;
+}
+
+void build(const char *cc, const char **srcs, size_t srcs_count, const char *bin, const char *out) {
+	build_config_t cfg = build_select_config(cc);
+
+	/* Objects, the cache and the linked binary of each configuration are kept apart */
+	char *dir       = build_config_dir(&cfg, bin);
+	char *cache     = FS_JOIN_PATH(dir, BUILD_CACHE_PATH);
+	char *deps_path = FS_JOIN_PATH(dir, BUILD_DEPS_PATH);
+	char *linked    = FS_JOIN_PATH(dir, fs_basename(out));
+	if (cache == NULL || deps_path == NULL || linked == NULL)
+		LOG_FAIL("malloc()");
+
+	if (!fs_exists(bin))
+		fs_create_dir(bin);
+
+	if (!fs_exists(dir) && fs_create_dir(dir) != 0)
+		LOG_FATAL("Failed to create directory '%s'", dir);
+
+	LOG_DEBUG("Building configuration '%s' in '%s'", cfg.name, dir);
+
+	/* Plain directories select their own sources and headers, anything else is a glob pattern */
+	char **globs = (char**)malloc(srcs_count * sizeof(*globs));
+	if (globs == NULL)
+		LOG_FAIL("malloc()");
+
+	for (size_t i = 0; i < srcs_count; ++ i) {
+		if (!build_is_glob(srcs[i]) && !fs_exists(srcs[i]))
+			LOG_FATAL("Failed to open directory '%s'", srcs[i]);
+
+		globs[i] = build_is_glob(srcs[i])? FS_JOIN_PATH(srcs[i]) :
+		           FS_JOIN_PATH(srcs[i], "*.{c,cc,cpp,cxx,h,hh,hpp,hxx}");
+		if (globs[i] == NULL)
+			LOG_FAIL("malloc()");
+	}
+
+	fs_glob_t g;
+	if (fs_glob_compile(&g, (const char**)globs, srcs_count) != 0)
+		LOG_FAIL("malloc()");
+
+	for (size_t i = 0; i < srcs_count; ++ i)
+		free(globs[i]);
+
+	free(globs);
+
+	build_srcs_t found = {0};
+	if (fs_glob(&g, 0, build_collect, &found) != 0)
+		LOG_FATAL("Failed to read the source directories");
+
+	fs_glob_free(&g);
+
+	/* Walk order depends on the file system, keep the link order stable */
+	qsort(found.buf, found.count, sizeof(*found.buf), build_src_cmp);
+
+	build_cache_t c;
+	if (build_cache_open(&c, cache) != 0)
+		LOG_FATAL("Build cache '%s' is corrupted", cache);
+
+	/* Objects are stamped with everything their source includes, so a changed header only
+	   rebuilds the sources that use it */
+	build_deps_t deps;
+	build_deps_open(&deps, deps_path, &cfg);
+
+	char       **o_files = (char**)malloc((found.count + 1) * sizeof(*o_files));
+	size_t      *files   = (size_t*)malloc((found.count + 1) * sizeof(*files));
+	build_job_t *jobs    = (build_job_t*)malloc((found.count + 1) * sizeof(*jobs));
+	if (o_files == NULL || files == NULL || jobs == NULL)
+		LOG_FAIL("malloc()");
+
+	/* Every source is read first, importing a module needs to know which source provides it */
+	size_t o_files_count = 0;
+	bool   cxx           = false;
+	for (size_t i = 0; i < found.count; ++ i) {
+		build_src_t *src = &found.buf[i];
+		if (build_lang(src->path) == BUILD_LANG_NONE) {
+			free(src->path);
+			free(src->out_name);
+			continue;
+		}
+
+		found.buf[o_files_count] = *src;
+		files[o_files_count ++]  = build_deps_source(&deps, src->path);
+	}
+
+	build_deps_index_modules(&deps, files, o_files_count);
+
+	size_t jobs_count = 0;
+	for (size_t i = 0; i < o_files_count; ++ i) {
+		build_src_t *src = &found.buf[i];
+		o_files[i] = FS_JOIN_PATH(dir, src->out_name);
+		if (o_files[i] == NULL)
+			LOG_FAIL("malloc()");
+
+		int64_t stamp  = build_deps_stamp(&deps, files[i]);
+		bool    is_cxx = build_lang(src->path) == BUILD_LANG_CXX;
+		cxx = cxx || is_cxx;
+
+		if (build_cache_get(&c, src->path) == stamp) {
+			LOG_DEBUG("'%s' is up to date", o_files[i]);
+			continue;
+		}
+
+		if (is_cxx)
+			build_job_new(jobs, &jobs_count, &c, cfg.cxx, src->path, o_files[i],
+			              cfg.cxx_args, cfg.cxx_args_count, stamp);
+		else
+			build_job_new(jobs, &jobs_count, &c, cfg.cc, src->path, o_files[i],
+			              cfg.args, cfg.args_count, stamp);
+
+		deps.buf[files[i]].job = jobs_count;
+	}
+
+	for (size_t i = 0; i < o_files_count; ++ i) {
+		build_dep_t *dep = &deps.buf[files[i]];
+		for (size_t j = 0; dep->job != 0 && j < dep->imports_count; ++ j) {
+			size_t provider = build_deps_provider(&deps, dep->imports[j]);
+			if (provider != (size_t)-1 && deps.buf[provider].job != 0)
+				build_job_wait_for(jobs, dep->job - 1, deps.buf[provider].job - 1);
+		}
+	}
+
+	build_deps_save(&deps);
+
+	bool built = jobs_count > 0;
+	bool ok    = build_run_jobs(jobs, jobs_count, &c);
+	for (size_t i = 0; i < jobs_count; ++ i) {
+		free(jobs[i].argv);
+		free(jobs[i].dependents);
+		free(jobs[i].rss_key);
+	}
+
+	/* Keep the sources that did compile */
+	if (!ok) {
+		if (build_cache_save(&c) != 0)
+			LOG_FATAL("Failed to save build cache");
+
+		LOG_FATAL("Failed to build '%s'", out);
+	}
+
+	for (size_t i = 0; i < o_files_count; ++ i) {
+		free(found.buf[i].path);
+		free(found.buf[i].out_name);
+	}
+
+	free(found.buf);
+	free(files);
+	free(jobs);
+	build_deps_free(&deps);
+
+	/* A removed source changes nothing that gets compiled, so the objects that go into the binary
+	   are part of its stamp */
+	uint64_t stamp = BUILD_HASH_INIT;
+	for (size_t i = 0; i < o_files_count; ++ i)
+		stamp = build_hash(stamp, o_files[i], strlen(o_files[i]) + 1);
+
+	if (o_files_count == 0)
+		LOG_INFO("Nothing to rebuild");
+	else if (!built && build_cache_get(&c, linked) == build_stamp(stamp) && fs_exists(linked)) {
+		LOG_DEBUG("'%s' is up to date", linked);
+		if (!build_publish(dir, linked, out, false))
+			LOG_INFO("Nothing to rebuild");
+	} else {
+		/* Forget the binary until it is linked and copied, a failure has to be retried */
+		build_cache_set(&c, linked, 0);
+		if (build_cache_save(&c) != 0)
+			LOG_FATAL("Failed to save build cache");
+
+		build_link(&cfg, o_files, o_files_count, linked, cxx);
+		build_publish(dir, linked, out, true);
+		build_cache_set(&c, linked, build_stamp(stamp));
+	}
+
+	if (build_cache_save(&c) != 0)
+		LOG_FATAL("Failed to save build cache");
+
+	for (size_t i = 0; i < o_files_count; ++ i)
+		free(o_files[i]);
+
+	free(o_files);
+	free(dir);
+	free(cache);
+	free(deps_path);
+	free(linked);
 	build_cache_free(&c);
 }
 
@@ -8,6 +8,17 @@
 #ifndef CFS_HEADER_GUARD
 #define CFS_HEADER_GUARD
 
+/* realpath, symlink, fstatat and the rest are POSIX, and reading the type of directory entries
+   and syscall need the BSD additions, all of which strict modes like -std=c99 hide */
+#if defined(CFS_IMPLEMENTATION) && defined(__STRICT_ANSI__)
+#	ifndef _POSIX_C_SOURCE
+#		define _POSIX_C_SOURCE 200809L
+#	endif
+#	ifndef _DEFAULT_SOURCE
+#		define _DEFAULT_SOURCE
+#	endif
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -19,8 +30,8 @@ extern "C" {
 #include <stdint.h>  /* int64_t */
 
 #define CFS_VERSION_MAJOR 1
-#define CFS_VERSION_MINOR 7
-#define CFS_VERSION_PATCH 2
+#define CFS_VERSION_MINOR 14
+#define CFS_VERSION_PATCH 0
 
 #ifndef WIN32
 #	if defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
@@ -58,11 +69,32 @@ extern "C" {
 
 #	define PATH_SEP "\\"
 #else
+#	include <stdio.h>
 #	include <unistd.h>
 #	include <dirent.h>
 #	include <fcntl.h>
 #	include <sys/stat.h>
 #	include <sys/types.h>
+#	include <errno.h>
+#	include <pthread.h>
+#	include <sys/mman.h>
+#	include <poll.h>
+#	include <time.h>
+
+#	ifdef __linux__
+#		include <sys/ioctl.h>
+#		include <sys/sendfile.h>
+#		include <sys/syscall.h>
+#		include <sys/inotify.h>
+
+/* Not every libc exposes FICLONE, its value is fixed by the kernel ABI */
+#		define FS_FICLONE _IOW(0x94, 9, int)
+#		define FS_HAVE_SENDFILE
+
+#		ifdef SYS_copy_file_range
+#			define FS_HAVE_COPY_FILE_RANGE
+#		endif
+#	endif
 
 /* Guarantee PATH_MAX to be defined */
 #	ifndef PATH_MAX
@@ -72,6 +104,10 @@ extern "C" {
 #	define PATH_SEP "/"
 #endif
 
+/* Bytes per copy_file_range/sendfile call and the buffer size of the fallback copy loop */
+#define FS_COPY_CHUNK_SIZE (1 << 30)
+#define FS_COPY_BUF_SIZE   (256 * 1024)
+
 enum {
 	FS_REGULAR = 0,
 	FS_HIDDEN  = 1 << 0,
@@ -126,6 +162,7 @@ const char *fs_basename(const char *path);
 const char *fs_ext(     const char *path);
 bool        fs_exists(  const char *path);
 
+char *fs_abs_path(  const char *path);
 char *fs_remove_ext(const char *path);
 char *fs_replace_ext(const char *path, const char *new_ext);
 
@@ -140,10 +177,156 @@ int fs_remove_dir( const char *path);
 int fs_copy_file(const char *path, const char *new_);
 int fs_move_file(const char *path, const char *new_);
 
+/* Files smaller than this are read into memory with a single read instead of being mapped */
+#define FS_MAP_MIN_SIZE (64 * 1024)
+
+typedef struct {
+#ifdef WIN32
+	HANDLE _file, _map;
+#endif
+	bool _mapped;
+
+	const char *data; /* Read-only and not null terminated */
+	size_t      size;
+} fs_map_t;
+
+int  fs_map_file(  fs_map_t *m, const char *path);
+void fs_unmap_file(fs_map_t *m);
+
 int fs_dir_open( fs_dir_t *d, const char *path);
 int fs_dir_close(fs_dir_t *d);
 int fs_dir_next( fs_dir_t *d, fs_ent_t *e);
 
+bool fs_match(const char *pattern, const char *str);
+
+enum {
+	FS_WALK_DIRS         = 1 << 0, /* Report directories too, not just files */
+	FS_WALK_HIDDEN       = 1 << 1, /* Report and enter hidden entries */
+	FS_WALK_FOLLOW_LINKS = 1 << 2, /* Enter links to directories */
+	FS_WALK_PARALLEL     = 1 << 3, /* Spread the directories across worker threads */
+};
+
+enum {
+	FS_WALK_CONTINUE = 0,
+	FS_WALK_SKIP,
+};
+
+typedef struct {
+	const char *path; /* Valid until fs_walk returns */
+	const char *name; /* Points into path */
+	int         attr;
+	size_t      depth; /* 0 for the entries of the walked directory itself */
+} fs_walk_ent_t;
+
+/* Callbacks are never called concurrently, not even in parallel mode */
+typedef int  (*fs_walk_prune_t)(const fs_walk_ent_t *e, void *data);
+typedef void (*fs_walk_batch_t)(const fs_walk_ent_t *ents, size_t count, void *data);
+typedef void (*fs_walk_error_t)(const char *path, void *data);
+
+#define FS_WALK_BATCH_SIZE 256
+
+typedef struct {
+	const char **exts;      /* NULL terminated list of file extensions to report, NULL for all */
+	const char  *glob;      /* Pattern for fs_match the file names have to match, NULL for all */
+	size_t       max_depth; /* How many levels deep to go, 0 for no limit */
+	int          flags;
+	size_t       threads;   /* Worker threads in parallel mode, 0 for the CPU count */
+	size_t       batch;     /* Entries per fs_walk_batch_t call, 0 for FS_WALK_BATCH_SIZE */
+
+	/* Called on every entry that passed the filters, FS_WALK_SKIP drops it and does not enter
+	   it if it is a directory */
+	fs_walk_prune_t prune;
+	void           *data;
+
+	/* Called on every directory inside of the walked one that could not be read, which is then
+	   skipped. Only failing to read the walked directory itself fails the walk */
+	fs_walk_error_t error;
+} fs_walk_opts_t;
+
+int fs_walk(const char *path, const fs_walk_opts_t *opts, fs_walk_batch_t cb, void *data);
+
+typedef struct {
+	char  *buf;
+	char **segs;
+	size_t segs_count;
+	size_t base;    /* Leading segments without wildcards, the directory to walk */
+	bool   exclude; /* Pattern started with '!' */
+	char   root[4]; /* "/" or a drive like "C:/" the pattern is absolute from, empty if relative */
+} fs_glob_pattern_t;
+
+/* Path patterns compiled once into a matcher. A "**" segment matches any number of directories,
+   "{a,b}" expands into one pattern per alternative, a leading '!' excludes what the pattern
+   matches and every other segment is matched with fs_match */
+typedef struct {
+	fs_glob_pattern_t *pats;
+	size_t             count, size;
+} fs_glob_t;
+
+int  fs_glob_compile(fs_glob_t *g, const char **patterns, size_t count);
+void fs_glob_free(   fs_glob_t *g);
+
+bool fs_glob_match(    const fs_glob_t *g, const char *path);
+bool fs_glob_match_dir(const fs_glob_t *g, const char *path);
+
+/* Walk every file matched by the glob. Directories nothing can match in are never entered.
+   Only the FS_WALK_HIDDEN, FS_WALK_FOLLOW_LINKS and FS_WALK_PARALLEL flags are used */
+int fs_glob(const fs_glob_t *g, int flags, fs_walk_batch_t cb, void *data);
+
+enum {
+	FS_WATCH_CREATED  = 1 << 0,
+	FS_WATCH_MODIFIED = 1 << 1,
+	FS_WATCH_REMOVED  = 1 << 2,
+	FS_WATCH_RESCAN   = 1 << 3, /* Events were lost, everything under the path has to be rescanned */
+};
+
+typedef struct {
+	char *path;
+	int   events;
+} fs_change_t;
+
+typedef struct {
+	char   *path;
+	int64_t mtime;
+} fs_watch_file_t;
+
+typedef struct {
+	int   wd;
+	char *path;
+} fs_watch_wd_t;
+
+#define FS_WATCH_POLL_MS 500
+
+typedef struct {
+	int    _fd;
+	size_t _debounce_ms;
+
+	/* inotify watch descriptors, sorted because the kernel hands them out in increasing order */
+	fs_watch_wd_t *_wds;
+	size_t         _wds_count, _wds_size;
+
+	char **_roots;
+	size_t _roots_count;
+
+	/* Used instead of inotify when it is not available or we ran out of watch descriptors */
+	bool             _polling;
+	fs_watch_file_t *_snap;
+	size_t           _snap_count;
+
+	fs_change_t *_changes;
+	size_t       _changes_count, _changes_size;
+} fs_watch_t;
+
+/* Changes that arrive within debounce_ms of each other are coalesced into a single change set */
+int  fs_watch_open( fs_watch_t *w, size_t debounce_ms);
+void fs_watch_close(fs_watch_t *w);
+
+/* Watches the directory and all of its subdirectories, including ones created later */
+int fs_watch_add(fs_watch_t *w, const char *path);
+
+/* Blocks until something changes or timeout_ms passes (-1 to wait forever). The changes stay
+   valid until the next fs_watch_wait call */
+int fs_watch_wait(fs_watch_t *w, int timeout_ms, const fs_change_t **changes, size_t *count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -288,6 +471,14 @@ int fs_attr(const char *path) {
 	return attr;
 }
 
+char *fs_abs_path(const char *path) {
+#ifdef WIN32
+	return _fullpath(NULL, path, 0);
+#else
+	return realpath(path, NULL);
+#endif
+}
+
 char *fs_remove_ext(const char *path) {
 	const char *ext = fs_ext(path);
 	size_t len      = strlen(path) - strlen(ext) - 1;
@@ -380,39 +571,76 @@ int fs_remove_file(const char *path) {
 #endif
 }
 
-int fs_copy_file(const char *path, const char *new_) {
-#ifdef WIN32
-	return !CopyFileA(path, new_, false)? -1 : 0;
+#ifndef WIN32
+/* Each copy method returns 1 when it copied the whole file, 0 when it is not supported for the
+   given files and -1 on error. They all advance the file offsets, so a method can take over
+   where the previous one gave up. Files of procfs or sysfs report a size of 0, and the kernel
+   copies nothing of them, so copying nothing at all is left to the next method too */
+
+static int fs_copy_clone(int from, int to) {
+#ifdef FS_FICLONE
+	return ioctl(to, FS_FICLONE, from) == 0? 1 : 0;
 #else
-	if (fs_exists(new_)) {
-		if (fs_remove_file(new_) != 0)
-			return -1;
-	}
+	(void)from;
+	(void)to;
+	return 0;
+#endif
+}
 
-	/* https://stackoverflow.com/questions/2180079/how-can-i-copy-a-file-on-unix-using-c */
-	int to, from;
+static int fs_copy_range(int from, int to) {
+#ifdef FS_HAVE_COPY_FILE_RANGE
+	ssize_t n;
+	bool    copied = false;
+	while ((n = syscall(SYS_copy_file_range, from, NULL, to, NULL, FS_COPY_CHUNK_SIZE, 0)) > 0)
+		copied = true;
+
+	if (n == 0)
+		return copied? 1 : 0;
+	else if (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)
+		return 0;
+	else
+		return -1;
+#else
+	(void)from;
+	(void)to;
+	return 0;
+#endif
+}
 
-	from = open(path, O_RDONLY);
-	if (from < 0)
+static int fs_copy_sendfile(int from, int to) {
+#ifdef FS_HAVE_SENDFILE
+	ssize_t n;
+	bool    copied = false;
+	while ((n = sendfile(to, from, NULL, FS_COPY_CHUNK_SIZE)) > 0)
+		copied = true;
+
+	if (n == 0)
+		return copied? 1 : 0;
+	else if (errno == ENOSYS || errno == EINVAL)
+		return 0;
+	else
 		return -1;
+#else
+	(void)from;
+	(void)to;
+	return 0;
+#endif
+}
 
-	to = open(new_, O_WRONLY | O_CREAT | O_EXCL, 0666);
-	if (to < 0) {
-		close(from);
+static int fs_copy_buffered(int from, int to) {
+	char *buf = (char*)malloc(FS_COPY_BUF_SIZE);
+	if (buf == NULL)
 		return -1;
-	}
 
-	char    buf[4096];
 	ssize_t read_;
-	while (read_ = read(from, buf, sizeof buf), read_ > 0) {
+	while (read_ = read(from, buf, FS_COPY_BUF_SIZE), read_ > 0) {
 		char   *out_ptr = buf;
 		ssize_t written;
 
 		do {
 			written = write(to, out_ptr, read_);
 			if (written < 0) {
-				close(from);
-				close(to);
+				free(buf);
 				return -1;
 			}
 
@@ -421,32 +649,177 @@ int fs_copy_file(const char *path, const char *new_) {
 		} while (read_ > 0);
 	}
 
-	if (read_ != 0)
+	free(buf);
+	return read_ == 0? 1 : -1;
+}
+#endif
+
+int fs_copy_file(const char *path, const char *new_) {
+#ifdef WIN32
+	return !CopyFileA(path, new_, false)? -1 : 0;
+#else
+	if (fs_exists(new_)) {
+		if (fs_remove_file(new_) != 0)
+			return -1;
+	}
+
+	int from = open(path, O_RDONLY);
+	if (from < 0)
 		return -1;
 
-	if (close(from) != 0)
+	struct stat s;
+	if (fstat(from, &s) != 0) {
+		close(from);
 		return -1;
-	if (close(to) != 0)
+	}
+
+	int to = open(new_, O_WRONLY | O_CREAT | O_EXCL, s.st_mode & 0777);
+	if (to < 0) {
+		close(from);
 		return -1;
+	}
 
-	struct stat s;
-	if (stat(path, &s) != 0)
+	/* Reflinks share the data blocks, copy_file_range and sendfile copy in the kernel without
+	   going through userspace, and the buffered loop works everywhere */
+	int done = fs_copy_clone(from, to);
+	if (done == 0)
+		done = fs_copy_range(from, to);
+	if (done == 0)
+		done = fs_copy_sendfile(from, to);
+	if (done == 0)
+		done = fs_copy_buffered(from, to);
+
+	if (done < 0) {
+		close(from);
+		close(to);
 		return -1;
+	}
 
-	chmod(new_, s.st_mode);
+	fchmod(to, s.st_mode);
 
-	return 0;
+	if (close(from) != 0) {
+		close(to);
+		return -1;
+	}
+
+	return close(to) != 0? -1 : 0;
 #endif
 }
 
 int fs_move_file(const char *path, const char *new_) {
 #ifdef WIN32
-	return !MoveFileA(path, new_)? -1 : 0;
+	/* Replace the destination like rename() does */
+	return !MoveFileExA(path, new_, MOVEFILE_REPLACE_EXISTING)? -1 : 0;
 #else
 	return rename(path, new_) != 0? -1 : 0;
 #endif
 }
 
+int fs_map_file(fs_map_t *m, const char *path) {
+	memset(m, 0, sizeof(*m));
+
+#ifdef WIN32
+	m->_file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+	                       FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (m->_file == INVALID_HANDLE_VALUE)
+		return -1;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m->_file, &size)) {
+		CloseHandle(m->_file);
+		return -1;
+	}
+
+	m->size = (size_t)size.QuadPart;
+	if (m->size == 0) {
+		CloseHandle(m->_file);
+		m->data = "";
+		return 0;
+	}
+
+	m->_map = CreateFileMappingA(m->_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m->_map == NULL) {
+		CloseHandle(m->_file);
+		return -1;
+	}
+
+	m->data = (const char*)MapViewOfFile(m->_map, FILE_MAP_READ, 0, 0, 0);
+	if (m->data == NULL) {
+		CloseHandle(m->_map);
+		CloseHandle(m->_file);
+		return -1;
+	}
+
+	m->_mapped = true;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	struct stat s;
+	if (fstat(fd, &s) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	m->size = (size_t)s.st_size;
+	if (m->size == 0)
+		m->data = "";
+	else if (m->size < FS_MAP_MIN_SIZE) {
+		/* Setting up a mapping costs more than just reading a small file */
+		char *buf = (char*)malloc(m->size);
+		if (buf == NULL) {
+			close(fd);
+			return -1;
+		}
+
+		size_t total = 0;
+		while (total < m->size) {
+			ssize_t n = read(fd, buf + total, m->size - total);
+			if (n <= 0) {
+				free(buf);
+				close(fd);
+				return -1;
+			}
+
+			total += (size_t)n;
+		}
+
+		m->data = buf;
+	} else {
+		void *ptr = mmap(NULL, m->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (ptr == MAP_FAILED) {
+			close(fd);
+			return -1;
+		}
+
+		posix_madvise(ptr, m->size, POSIX_MADV_SEQUENTIAL);
+
+		m->data    = (const char*)ptr;
+		m->_mapped = true;
+	}
+
+	close(fd);
+#endif
+
+	return 0;
+}
+
+void fs_unmap_file(fs_map_t *m) {
+	if (m->_mapped) {
+#ifdef WIN32
+		UnmapViewOfFile(m->data);
+		CloseHandle(m->_map);
+		CloseHandle(m->_file);
+#else
+		munmap((void*)m->data, m->size);
+#endif
+	} else if (m->size > 0)
+		free((void*)m->data);
+
+	memset(m, 0, sizeof(*m));
+}
+
 int fs_dir_open(fs_dir_t *d, const char *path) {
 #ifdef WIN32
 	char pattern[MAX_PATH] = {0};
@@ -481,6 +854,49 @@ int fs_dir_close(fs_dir_t *d) {
 	return 0;
 }
 
+#ifdef WIN32
+static int fs_attr_from_data(const WIN32_FIND_DATA *data) {
+	int attr = FS_REGULAR;
+
+	if (data->dwFileAttributes & FILE_ATTRIBUTE_HIDDEN ||
+	    strcmp(data->cFileName, ".") == 0 || strcmp(data->cFileName, "..") == 0)
+		attr |= FS_HIDDEN;
+	if (data->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+		attr |= FS_DIR;
+	if (data->dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+		attr |= FS_LINK;
+
+	return attr;
+}
+#else
+/* Only used when d_type can not tell us enough. Going through the directory fd saves building
+   the full path of the entry */
+static int fs_attr_at(DIR *d, const char *name, bool is_link) {
+	int         attr = FS_REGULAR;
+	struct stat s;
+
+	if (!is_link) {
+		if (fstatat(dirfd(d), name, &s, AT_SYMLINK_NOFOLLOW) != 0)
+			return FS_INVALID_ATTR;
+
+		is_link = S_ISLNK(s.st_mode);
+	}
+
+	if (is_link) {
+		attr |= FS_LINK;
+
+		/* Links get the attributes of their target, a dangling link is still a valid entry */
+		if (fstatat(dirfd(d), name, &s, 0) != 0)
+			return attr;
+	}
+
+	if (S_ISDIR(s.st_mode))
+		attr |= FS_DIR;
+
+	return attr;
+}
+#endif
+
 int fs_dir_next(fs_dir_t *d, fs_ent_t *e) {
 #ifdef WIN32
 	if (d->_first)
@@ -492,23 +908,1389 @@ int fs_dir_next(fs_dir_t *d, fs_ent_t *e) {
 
 	e->_data = d->_data;
 	e->name  = e->_data.cFileName;
+	e->attr  = fs_attr_from_data(&e->_data);
 #else
+	/* readdir() already reads the entries in bulk with getdents64 */
 	e->_e = readdir(d->_d);
 	if (e->_e == NULL)
 		return -1;
 
 	e->name = e->_e->d_name;
-#endif
 
-	char path[PATH_MAX] = {0};
-	strcpy(path, d->path);
-	strcat(path, "/");
-	strcat(path, e->name);
+#	if defined(_DIRENT_HAVE_D_TYPE) && defined(DT_UNKNOWN)
+	switch (e->_e->d_type) {
+	case DT_REG: e->attr = FS_REGULAR;                       break;
+	case DT_DIR: e->attr = FS_DIR;                           break;
+	case DT_LNK: e->attr = fs_attr_at(d->_d, e->name, true); break;
+
+	default: e->attr = fs_attr_at(d->_d, e->name, false);
+	}
+#	else
+	e->attr = fs_attr_at(d->_d, e->name, false);
+#	endif
 
-	e->attr = fs_attr(path);
 	if (e->attr == FS_INVALID_ATTR)
 		return -1;
 
+	if (e->name[0] == '.')
+		e->attr |= FS_HIDDEN;
+#endif
+
+	return 0;
+}
+
+bool fs_match(const char *pattern, const char *str) {
+	const char *star = NULL, *resume = NULL;
+
+	while (*str != '\0') {
+		if (*pattern == '*') {
+			star   = pattern ++;
+			resume = str;
+			continue;
+		} else if (*pattern == '[') {
+			const char *p       = pattern + 1;
+			bool        negate  = *p == '!' || *p == '^';
+			bool        matched = false;
+			if (negate)
+				++ p;
+
+			for (; *p != '\0' && (*p != ']' || p == pattern + 1 + negate); ++ p) {
+				if (p[1] == '-' && p[2] != ']' && p[2] != '\0') {
+					if (*str >= p[0] && *str <= p[2])
+						matched = true;
+
+					p += 2;
+				} else if (*p == *str)
+					matched = true;
+			}
+
+			if (*p == ']' && matched != negate) {
+				pattern = p + 1;
+				++ str;
+				continue;
+			}
+		} else if (*pattern == '?' || *pattern == *str) {
+			++ pattern;
+			++ str;
+			continue;
+		}
+
+		/* Backtrack to the last star and let it eat one more character */
+		if (star == NULL)
+			return false;
+
+		pattern = star + 1;
+		str     = ++ resume;
+	}
+
+	while (*pattern == '*')
+		++ pattern;
+
+	return *pattern == '\0';
+}
+
+/* Every path found by a walk lives in an arena, freed all at once when the walk is done */
+#define FS_ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct fs_arena_block {
+	struct fs_arena_block *next;
+	size_t                 size, used;
+} fs_arena_block_t;
+
+typedef struct {
+	fs_arena_block_t *head;
+} fs_arena_t;
+
+static char *fs_arena_alloc(fs_arena_t *a, size_t size) {
+	if (a->head == NULL || a->head->used + size > a->head->size) {
+		size_t block_size = size > FS_ARENA_BLOCK_SIZE? size : FS_ARENA_BLOCK_SIZE;
+
+		fs_arena_block_t *block = (fs_arena_block_t*)malloc(sizeof(*block) + block_size);
+		if (block == NULL)
+			return NULL;
+
+		block->next = a->head;
+		block->size = block_size;
+		block->used = 0;
+		a->head     = block;
+	}
+
+	char *ptr = (char*)(a->head + 1) + a->head->used;
+	a->head->used += size;
+	return ptr;
+}
+
+static void fs_arena_free(fs_arena_t *a) {
+	while (a->head != NULL) {
+		fs_arena_block_t *next = a->head->next;
+		free(a->head);
+		a->head = next;
+	}
+}
+
+#ifdef WIN32
+/* No parallel mode on Windows, the walk always runs on the calling thread */
+#	define FS_LOCK(WALK)
+#	define FS_UNLOCK(WALK)
+#	define FS_WAIT(WALK)
+#	define FS_WAKE(WALK)
+#else
+#	define FS_LOCK(WALK)   pthread_mutex_lock(&(WALK)->lock)
+#	define FS_UNLOCK(WALK) pthread_mutex_unlock(&(WALK)->lock)
+#	define FS_WAIT(WALK)   pthread_cond_wait(&(WALK)->cond, &(WALK)->lock)
+#	define FS_WAKE(WALK)   pthread_cond_broadcast(&(WALK)->cond)
+#endif
+
+/* Directories entered while following links, each with the one above it, to stop at links that
+   lead back up. Windows has no inode numbers for it */
+typedef struct fs_walk_seen {
+	const struct fs_walk_seen *parent;
+#ifndef WIN32
+	dev_t dev;
+	ino_t ino;
+#endif
+} fs_walk_seen_t;
+
+typedef struct {
+	const char           *path;
+	size_t                depth;
+	const fs_walk_seen_t *seen;
+} fs_walk_dir_t;
+
+typedef struct {
+	const fs_walk_opts_t *opts;
+	fs_walk_batch_t       cb;
+	void                 *data;
+	size_t                batch;
+
+	fs_walk_dir_t *queue;
+	size_t         queue_count, queue_size;
+	size_t         pending; /* Directories queued or being read */
+	int            status;
+
+#ifndef WIN32
+	pthread_mutex_t lock, cb_lock;
+	pthread_cond_t  cond;
+#endif
+} fs_walk_t;
+
+typedef struct {
+	fs_walk_t     *walk;
+	fs_arena_t     arena;
+	fs_walk_ent_t *ents;
+	size_t         ents_count;
+} fs_walker_t;
+
+static void fs_walk_fail(fs_walk_t *w) {
+	FS_LOCK(w);
+	w->status = -1;
+	FS_UNLOCK(w);
+}
+
+static void fs_walk_flush(fs_walker_t *wr) {
+	if (wr->ents_count == 0)
+		return;
+
+#ifndef WIN32
+	pthread_mutex_lock(&wr->walk->cb_lock);
+#endif
+	wr->walk->cb(wr->ents, wr->ents_count, wr->walk->data);
+#ifndef WIN32
+	pthread_mutex_unlock(&wr->walk->cb_lock);
+#endif
+
+	wr->ents_count = 0;
+}
+
+static int fs_walk_prune(fs_walker_t *wr, const fs_walk_ent_t *e) {
+	if (wr->walk->opts->prune == NULL)
+		return FS_WALK_CONTINUE;
+
+#ifndef WIN32
+	pthread_mutex_lock(&wr->walk->cb_lock);
+#endif
+	int ret = wr->walk->opts->prune(e, wr->walk->opts->data);
+#ifndef WIN32
+	pthread_mutex_unlock(&wr->walk->cb_lock);
+#endif
+
+	return ret;
+}
+
+static void fs_walk_error(fs_walker_t *wr, const char *path) {
+	if (wr->walk->opts->error == NULL)
+		return;
+
+#ifndef WIN32
+	pthread_mutex_lock(&wr->walk->cb_lock);
+#endif
+	wr->walk->opts->error(path, wr->walk->opts->data);
+#ifndef WIN32
+	pthread_mutex_unlock(&wr->walk->cb_lock);
+#endif
+}
+
+/* Returns 1 if the directory is not one of those above it, 0 if it is or could not be looked
+   at and -1 on failure. Only directories inside of the walked one are reported as errors */
+static int fs_walk_enter(fs_walker_t *wr, const char *path, const fs_walk_seen_t *parent,
+                         const fs_walk_seen_t **seen) {
+	/* The arena is shared with the paths, so it has to be aligned here */
+	char *ptr = fs_arena_alloc(&wr->arena, sizeof(fs_walk_seen_t) + 15);
+	if (ptr == NULL)
+		return -1;
+
+	fs_walk_seen_t *node = (fs_walk_seen_t*)(((uintptr_t)ptr + 15) & ~(uintptr_t)15);
+	node->parent = parent;
+
+#ifndef WIN32
+	struct stat s;
+	if (stat(path, &s) != 0) {
+		if (parent != NULL)
+			fs_walk_error(wr, path);
+
+		return 0;
+	}
+
+	node->dev = s.st_dev;
+	node->ino = s.st_ino;
+	for (const fs_walk_seen_t *it = parent; it != NULL; it = it->parent) {
+		if (it->dev == node->dev && it->ino == node->ino)
+			return 0;
+	}
+#endif
+
+	*seen = node;
+	return 1;
+}
+
+static bool fs_walk_push(fs_walk_t *w, const char *path, size_t depth,
+                         const fs_walk_seen_t *seen) {
+	FS_LOCK(w);
+	if (w->queue_count >= w->queue_size) {
+		w->queue_size = w->queue_size == 0? 64 : w->queue_size * 2;
+		void *ptr = realloc(w->queue, w->queue_size * sizeof(*w->queue));
+		if (ptr == NULL) {
+			w->status = -1;
+			FS_UNLOCK(w);
+			return false;
+		}
+
+		w->queue = (fs_walk_dir_t*)ptr;
+	}
+
+	w->queue[w->queue_count].path  = path;
+	w->queue[w->queue_count].depth = depth;
+	w->queue[w->queue_count].seen  = seen;
+	++ w->queue_count;
+	++ w->pending;
+
+	FS_WAKE(w);
+	FS_UNLOCK(w);
+	return true;
+}
+
+static bool fs_walk_wants(const fs_walk_opts_t *opts, const char *name) {
+	if (opts->exts != NULL) {
+		const char *ext = fs_ext(name);
+
+		bool found = false;
+		for (const char **next = opts->exts; *next != NULL; ++ next) {
+			if (strcmp(*next, ext) == 0) {
+				found = true;
+				break;
+			}
+		}
+
+		if (!found)
+			return false;
+	}
+
+	return opts->glob == NULL || fs_match(opts->glob, name);
+}
+
+static void fs_walk_dir(fs_walker_t *wr, const fs_walk_dir_t *dir) {
+	fs_walk_t            *w    = wr->walk;
+	const fs_walk_opts_t *opts = w->opts;
+
+	size_t dir_len = strlen(dir->path);
+	bool   enter   = opts->max_depth == 0 || dir->depth + 1 < opts->max_depth;
+
+	int status;
+	FOREACH_IN_DIR(dir->path, d, ent, {
+		if (strcmp(ent.name, ".") == 0 || strcmp(ent.name, "..") == 0)
+			continue;
+
+		if (ent.attr & FS_HIDDEN && !(opts->flags & FS_WALK_HIDDEN))
+			continue;
+
+		bool is_dir = ent.attr & FS_DIR;
+		if (is_dir) {
+			if (!enter && !(opts->flags & FS_WALK_DIRS))
+				continue;
+		} else if (!fs_walk_wants(opts, ent.name))
+			continue;
+
+		size_t name_len = strlen(ent.name);
+		char  *path     = fs_arena_alloc(&wr->arena, dir_len + name_len + 2);
+		if (path == NULL) {
+			fs_walk_fail(w);
+			break;
+		}
+
+		memcpy(path, dir->path, dir_len);
+		path[dir_len] = PATH_SEP[0];
+		memcpy(path + dir_len + 1, ent.name, name_len + 1);
+
+		fs_walk_ent_t *e = &wr->ents[wr->ents_count];
+		e->path  = path;
+		e->name  = path + dir_len + 1;
+		e->attr  = ent.attr;
+		e->depth = dir->depth;
+
+		if (fs_walk_prune(wr, e) == FS_WALK_SKIP)
+			continue;
+
+		if (is_dir && enter && (!(ent.attr & FS_LINK) || opts->flags & FS_WALK_FOLLOW_LINKS)) {
+			const fs_walk_seen_t *seen = NULL;
+
+			int entered = 1;
+			if (opts->flags & FS_WALK_FOLLOW_LINKS)
+				entered = fs_walk_enter(wr, path, dir->seen, &seen);
+
+			if (entered < 0) {
+				fs_walk_fail(w);
+				break;
+			} else if (entered > 0 && !fs_walk_push(w, path, dir->depth + 1, seen))
+				break;
+		}
+
+		if (!is_dir || opts->flags & FS_WALK_DIRS) {
+			if (++ wr->ents_count >= w->batch)
+				fs_walk_flush(wr);
+		}
+	}, status);
+
+	if (status == 0)
+		return;
+	else if (dir->depth == 0)
+		fs_walk_fail(w);
+	else
+		fs_walk_error(wr, dir->path);
+}
+
+static void *fs_walk_worker(void *arg) {
+	fs_walker_t *wr = (fs_walker_t*)arg;
+	fs_walk_t   *w  = wr->walk;
+
+	FS_LOCK(w);
+	for (;;) {
+		while (w->queue_count == 0 && w->pending > 0)
+			FS_WAIT(w);
+
+		if (w->queue_count == 0)
+			break;
+
+		fs_walk_dir_t dir = w->queue[-- w->queue_count];
+		FS_UNLOCK(w);
+
+		fs_walk_dir(wr, &dir);
+
+		FS_LOCK(w);
+		if (-- w->pending == 0)
+			FS_WAKE(w);
+	}
+	FS_UNLOCK(w);
+
+	fs_walk_flush(wr);
+	return NULL;
+}
+
+int fs_walk(const char *path, const fs_walk_opts_t *opts, fs_walk_batch_t cb, void *data) {
+	fs_walk_opts_t default_opts;
+	if (opts == NULL) {
+		memset(&default_opts, 0, sizeof(default_opts));
+		opts = &default_opts;
+	}
+
+	fs_walk_t w;
+	memset(&w, 0, sizeof(w));
+	w.opts  = opts;
+	w.cb    = cb;
+	w.data  = data;
+	w.batch = opts->batch == 0? FS_WALK_BATCH_SIZE : opts->batch;
+
+	size_t threads = 1;
+#ifndef WIN32
+	if (opts->flags & FS_WALK_PARALLEL) {
+		threads = opts->threads;
+		if (threads == 0) {
+			long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+			threads   = cpus > 0? (size_t)cpus : 1;
+		}
+	}
+
+	pthread_mutex_init(&w.lock,    NULL);
+	pthread_mutex_init(&w.cb_lock, NULL);
+	pthread_cond_init(&w.cond, NULL);
+#endif
+
+	fs_walker_t *walkers = (fs_walker_t*)calloc(threads, sizeof(*walkers));
+	if (walkers == NULL)
+		w.status = -1;
+	else {
+		for (size_t i = 0; i < threads; ++ i) {
+			walkers[i].walk = &w;
+			walkers[i].ents = (fs_walk_ent_t*)malloc(w.batch * sizeof(*walkers[i].ents));
+			if (walkers[i].ents == NULL)
+				w.status = -1;
+		}
+	}
+
+	const fs_walk_seen_t *seen = NULL;
+	if (w.status == 0 && opts->flags & FS_WALK_FOLLOW_LINKS &&
+	    fs_walk_enter(&walkers[0], path, NULL, &seen) <= 0)
+		w.status = -1;
+
+	if (w.status == 0 && fs_walk_push(&w, path, 0, seen)) {
+#ifndef WIN32
+		pthread_t *ids     = NULL;
+		size_t     spawned = 0;
+		if (threads > 1) {
+			ids = (pthread_t*)malloc((threads - 1) * sizeof(*ids));
+			for (; ids != NULL && spawned < threads - 1; ++ spawned) {
+				if (pthread_create(&ids[spawned], NULL, fs_walk_worker, &walkers[spawned + 1]) != 0)
+					break;
+			}
+		}
+#endif
+
+		/* The calling thread is a worker too, it is the only one in serial mode */
+		fs_walk_worker(&walkers[0]);
+
+#ifndef WIN32
+		for (size_t i = 0; i < spawned; ++ i)
+			pthread_join(ids[i], NULL);
+
+		free(ids);
+#endif
+	}
+
+	if (walkers != NULL) {
+		for (size_t i = 0; i < threads; ++ i) {
+			fs_arena_free(&walkers[i].arena);
+			free(walkers[i].ents);
+		}
+
+		free(walkers);
+	}
+
+	free(w.queue);
+
+#ifndef WIN32
+	pthread_mutex_destroy(&w.lock);
+	pthread_mutex_destroy(&w.cb_lock);
+	pthread_cond_destroy(&w.cond);
+#endif
+
+	return w.status;
+}
+
+static bool fs_is_sep(char ch) {
+	return ch == '/' || ch == '\\';
+}
+
+/* Copies the root an absolute path starts with into root, with '/' as the separator. Returns
+   its length in the path, 0 for a relative path */
+static size_t fs_glob_root(const char *path, char *root) {
+	size_t len = 0;
+	if (fs_is_sep(path[0]))
+		len = 1;
+	else if (((path[0] >= 'a' && path[0] <= 'z') || (path[0] >= 'A' && path[0] <= 'Z')) &&
+	         path[1] == ':' && fs_is_sep(path[2]))
+		len = 3;
+
+	memcpy(root, path, len);
+	if (len > 0)
+		root[len - 1] = '/';
+
+	root[len] = '\0';
+	return len;
+}
+
+static bool fs_glob_add(fs_glob_t *g, const char *pattern, size_t len) {
+	if (g->count >= g->size) {
+		g->size = g->size == 0? 8 : g->size * 2;
+		void *ptr = realloc(g->pats, g->size * sizeof(*g->pats));
+		if (ptr == NULL)
+			return false;
+
+		g->pats = (fs_glob_pattern_t*)ptr;
+	}
+
+	fs_glob_pattern_t *p = &g->pats[g->count];
+	memset(p, 0, sizeof(*p));
+
+	if (len > 0 && pattern[0] == '!') {
+		p->exclude = true;
+		++ pattern;
+		-- len;
+	}
+
+	/* The root is kept apart from the segments, it is where the walk starts */
+	size_t root_len = len > 0? fs_glob_root(pattern, p->root) : 0;
+	pattern += root_len;
+	len     -= root_len;
+
+	while (len >= 2 && pattern[0] == '.' && fs_is_sep(pattern[1])) {
+		pattern += 2;
+		len     -= 2;
+	}
+
+	p->buf = (char*)malloc(len + 1);
+	if (p->buf == NULL)
+		return false;
+
+	memcpy(p->buf, pattern, len);
+	p->buf[len] = '\0';
+
+	size_t count = 1;
+	for (size_t i = 0; i < len; ++ i) {
+		if (fs_is_sep(p->buf[i]))
+			++ count;
+	}
+
+	p->segs = (char**)malloc(count * sizeof(*p->segs));
+	if (p->segs == NULL) {
+		free(p->buf);
+		return false;
+	}
+
+	bool literal = true;
+	for (char *next = p->buf, *it = p->buf;; ++ it) {
+		if (*it != '\0' && !fs_is_sep(*it))
+			continue;
+
+		bool end = *it == '\0';
+		*it = '\0';
+
+		/* Skip empty segments from doubled separators */
+		if (*next != '\0') {
+			if (literal && strpbrk(next, "*?[") == NULL)
+				++ p->base;
+			else
+				literal = false;
+
+			p->segs[p->segs_count ++] = next;
+		}
+
+		if (end)
+			break;
+
+		next = it + 1;
+	}
+
+	/* The last segment always names the files, so it is never part of the directory */
+	if (p->base >= p->segs_count)
+		p->base = p->segs_count == 0? 0 : p->segs_count - 1;
+
+	++ g->count;
+	return true;
+}
+
+/* Expand the first brace group of the pattern and recurse on every alternative */
+static bool fs_glob_expand(fs_glob_t *g, const char *pattern, size_t len) {
+	size_t open = len, close = len, depth = 0;
+	for (size_t i = 0; i < len; ++ i) {
+		if (pattern[i] == '{') {
+			if (depth ++ == 0)
+				open = i;
+		} else if (pattern[i] == '}' && depth > 0) {
+			if (-- depth == 0) {
+				close = i;
+				break;
+			}
+		}
+	}
+
+	if (close == len)
+		return fs_glob_add(g, pattern, len);
+
+	char *buf = (char*)malloc(len);
+	if (buf == NULL)
+		return false;
+
+	memcpy(buf, pattern, open);
+
+	size_t start = open + 1;
+	depth = 0;
+	for (size_t i = start; i <= close; ++ i) {
+		if (pattern[i] == '{')
+			++ depth;
+		else if (pattern[i] == '}' && depth > 0)
+			-- depth;
+		else if ((pattern[i] == ',' && depth == 0) || i == close) {
+			size_t alt_len  = i - start;
+			size_t rest_len = len - close - 1;
+
+			memcpy(buf + open, pattern + start, alt_len);
+			memcpy(buf + open + alt_len, pattern + close + 1, rest_len);
+
+			if (!fs_glob_expand(g, buf, open + alt_len + rest_len)) {
+				free(buf);
+				return false;
+			}
+
+			start = i + 1;
+		}
+	}
+
+	free(buf);
+	return true;
+}
+
+int fs_glob_compile(fs_glob_t *g, const char **patterns, size_t count) {
+	memset(g, 0, sizeof(*g));
+
+	for (size_t i = 0; i < count; ++ i) {
+		if (!fs_glob_expand(g, patterns[i], strlen(patterns[i]))) {
+			fs_glob_free(g);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void fs_glob_free(fs_glob_t *g) {
+	for (size_t i = 0; i < g->count; ++ i) {
+		free(g->pats[i].buf);
+		free(g->pats[i].segs);
+	}
+
+	free(g->pats);
+	memset(g, 0, sizeof(*g));
+}
+
+/* With partial set, tells if anything inside of the path could still match */
+static bool fs_glob_match_segs(char **pat, size_t pat_count, char **path, size_t path_count,
+                               bool partial) {
+	while (pat_count > 0) {
+		if (strcmp(pat[0], "**") == 0) {
+			if (fs_glob_match_segs(pat + 1, pat_count - 1, path, path_count, partial))
+				return true;
+			if (path_count == 0)
+				return partial;
+
+			++ path;
+			-- path_count;
+			continue;
+		}
+
+		if (path_count == 0)
+			return partial;
+		if (!fs_match(pat[0], path[0]))
+			return false;
+
+		++ pat;
+		++ path;
+		-- pat_count;
+		-- path_count;
+	}
+
+	return path_count == 0 && !partial;
+}
+
+#define FS_GLOB_MAX_DEPTH 128
+
+static size_t fs_glob_split(const char *path, char *buf, char **segs, char *root) {
+	path += fs_glob_root(path, root);
+	while (path[0] == '.' && fs_is_sep(path[1]))
+		path += 2;
+
+	strncpy(buf, path, PATH_MAX - 1);
+	buf[PATH_MAX - 1] = '\0';
+
+	size_t count = 0;
+	for (char *next = buf, *it = buf; count < FS_GLOB_MAX_DEPTH; ++ it) {
+		if (*it != '\0' && !fs_is_sep(*it))
+			continue;
+
+		bool end = *it == '\0';
+		*it = '\0';
+
+		if (*next != '\0')
+			segs[count ++] = next;
+
+		if (end)
+			break;
+
+		next = it + 1;
+	}
+
+	return count;
+}
+
+bool fs_glob_match(const fs_glob_t *g, const char *path) {
+	char   buf[PATH_MAX], root[4];
+	char  *segs[FS_GLOB_MAX_DEPTH];
+	size_t count = fs_glob_split(path, buf, segs, root);
+
+	bool matched = false;
+	for (size_t i = 0; i < g->count; ++ i) {
+		const fs_glob_pattern_t *p = &g->pats[i];
+		if (p->exclude != matched || strcmp(p->root, root) != 0)
+			continue;
+
+		if (fs_glob_match_segs(p->segs, p->segs_count, segs, count, false))
+			matched = !p->exclude;
+	}
+
+	/* Excluding a directory excludes everything inside of it as well */
+	for (size_t i = 0; matched && i < count; ++ i) {
+		for (size_t j = 0; j < g->count; ++ j) {
+			const fs_glob_pattern_t *p = &g->pats[j];
+			if (p->exclude && strcmp(p->root, root) == 0 &&
+			    fs_glob_match_segs(p->segs, p->segs_count, segs, i, false))
+				return false;
+		}
+	}
+
+	return matched;
+}
+
+bool fs_glob_match_dir(const fs_glob_t *g, const char *path) {
+	char   buf[PATH_MAX], root[4];
+	char  *segs[FS_GLOB_MAX_DEPTH];
+	size_t count = fs_glob_split(path, buf, segs, root);
+
+	bool enter = false;
+	for (size_t i = 0; i < g->count; ++ i) {
+		const fs_glob_pattern_t *p = &g->pats[i];
+		if (strcmp(p->root, root) != 0)
+			continue;
+		else if (p->exclude) {
+			/* Excluding the directory and excluding all of its contents with a trailing "**" are
+			   the same thing */
+			size_t segs_count = p->segs_count;
+			if (segs_count > 0 && strcmp(p->segs[segs_count - 1], "**") == 0)
+				-- segs_count;
+
+			if (fs_glob_match_segs(p->segs, segs_count, segs, count, false))
+				return false;
+		} else if (!enter)
+			enter = fs_glob_match_segs(p->segs, p->segs_count, segs, count, true);
+	}
+
+	return enter;
+}
+
+static int fs_glob_prune(const fs_walk_ent_t *e, void *data) {
+	const fs_glob_t *g = (const fs_glob_t*)data;
+
+	if (e->attr & FS_DIR)
+		return fs_glob_match_dir(g, e->path)? FS_WALK_CONTINUE : FS_WALK_SKIP;
+	else
+		return fs_glob_match(g, e->path)? FS_WALK_CONTINUE : FS_WALK_SKIP;
+}
+
+/* Is the base of pattern b inside of the base of pattern a */
+static bool fs_glob_base_in(const fs_glob_pattern_t *a, const fs_glob_pattern_t *b) {
+	if (a->base > b->base || strcmp(a->root, b->root) != 0)
+		return false;
+
+	for (size_t i = 0; i < a->base; ++ i) {
+		if (strcmp(a->segs[i], b->segs[i]) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+int fs_glob(const fs_glob_t *g, int flags, fs_walk_batch_t cb, void *data) {
+	fs_walk_opts_t opts;
+	memset(&opts, 0, sizeof(opts));
+	opts.flags = flags & (FS_WALK_HIDDEN | FS_WALK_FOLLOW_LINKS | FS_WALK_PARALLEL);
+	opts.prune = fs_glob_prune;
+	opts.data  = (void*)g;
+
+	int status = 0;
+	for (size_t i = 0; i < g->count; ++ i) {
+		const fs_glob_pattern_t *p = &g->pats[i];
+		if (p->exclude)
+			continue;
+
+		/* Walk every base directory once, even if several patterns share it */
+		bool walked = false;
+		for (size_t j = 0; j < g->count && !walked; ++ j) {
+			const fs_glob_pattern_t *other = &g->pats[j];
+			if (j == i || other->exclude || !fs_glob_base_in(other, p))
+				continue;
+
+			walked = j < i || !fs_glob_base_in(p, other);
+		}
+
+		if (walked)
+			continue;
+
+		char   path[PATH_MAX] = ".";
+		size_t len            = strlen(p->root);
+		if (len > 0)
+			memcpy(path, p->root, len + 1);
+		else if (p->base == 0)
+			len = 1;
+
+		for (size_t j = 0; j < p->base; ++ j) {
+			size_t seg_len = strlen(p->segs[j]);
+			if (len + seg_len + 2 > sizeof(path))
+				return -1;
+
+			if (j > 0)
+				path[len ++] = PATH_SEP[0];
+
+			memcpy(path + len, p->segs[j], seg_len + 1);
+			len += seg_len;
+		}
+
+		/* A missing base directory means the pattern has nothing to match */
+		if (!fs_exists(path))
+			continue;
+
+		if (fs_walk(path, &opts, cb, data) != 0)
+			status = -1;
+	}
+
+	return status;
+}
+
+#ifdef __linux__
+static int64_t fs_watch_now_ms(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+#endif
+
+static void fs_watch_sleep(int ms) {
+#ifdef WIN32
+	Sleep((DWORD)ms);
+#else
+	poll(NULL, 0, ms);
+#endif
+}
+
+static void fs_watch_clear(fs_watch_t *w) {
+	for (size_t i = 0; i < w->_changes_count; ++ i)
+		free(w->_changes[i].path);
+
+	w->_changes_count = 0;
+}
+
+/* Takes ownership of the path */
+static int fs_watch_change(fs_watch_t *w, char *path, int events) {
+	if (path == NULL)
+		return -1;
+
+	for (size_t i = 0; i < w->_changes_count; ++ i) {
+		if (strcmp(w->_changes[i].path, path) == 0) {
+			w->_changes[i].events |= events;
+			free(path);
+			return 0;
+		}
+	}
+
+	if (w->_changes_count >= w->_changes_size) {
+		w->_changes_size = w->_changes_size == 0? 32 : w->_changes_size * 2;
+		void *ptr = realloc(w->_changes, w->_changes_size * sizeof(*w->_changes));
+		if (ptr == NULL) {
+			free(path);
+			return -1;
+		}
+
+		w->_changes = (fs_change_t*)ptr;
+	}
+
+	w->_changes[w->_changes_count].path   = path;
+	w->_changes[w->_changes_count].events = events;
+	++ w->_changes_count;
+	return 0;
+}
+
+typedef struct {
+	fs_watch_file_t *buf;
+	size_t           count, size;
+	int              status;
+} fs_watch_snap_t;
+
+static void fs_watch_snap_collect(const fs_walk_ent_t *ents, size_t count, void *data) {
+	fs_watch_snap_t *snap = (fs_watch_snap_t*)data;
+
+	for (size_t i = 0; i < count && snap->status == 0; ++ i) {
+		if (snap->count >= snap->size) {
+			snap->size = snap->size == 0? 256 : snap->size * 2;
+			void *ptr = realloc(snap->buf, snap->size * sizeof(*snap->buf));
+			if (ptr == NULL) {
+				snap->status = -1;
+				return;
+			}
+
+			snap->buf = (fs_watch_file_t*)ptr;
+		}
+
+		fs_watch_file_t *file = &snap->buf[snap->count];
+		file->path = FS_JOIN_PATH(ents[i].path);
+		if (file->path == NULL) {
+			snap->status = -1;
+			return;
+		}
+
+		/* A file removed between the walk and here will be reported on the next scan */
+		file->mtime = -1;
+		fs_time(file->path, &file->mtime, NULL);
+		++ snap->count;
+	}
+}
+
+static int fs_watch_file_cmp(const void *a, const void *b) {
+	return strcmp(((const fs_watch_file_t*)a)->path, ((const fs_watch_file_t*)b)->path);
+}
+
+static void fs_watch_snap_free(fs_watch_file_t *snap, size_t count) {
+	for (size_t i = 0; i < count; ++ i)
+		free(snap[i].path);
+
+	free(snap);
+}
+
+static int fs_watch_scan(fs_watch_t *w, fs_watch_file_t **snap, size_t *count) {
+	fs_watch_snap_t s = {0};
+
+	fs_walk_opts_t opts;
+	memset(&opts, 0, sizeof(opts));
+	for (size_t i = 0; i < w->_roots_count; ++ i) {
+		if (fs_walk(w->_roots[i], &opts, fs_watch_snap_collect, &s) != 0)
+			s.status = -1;
+	}
+
+	if (s.status != 0) {
+		fs_watch_snap_free(s.buf, s.count);
+		return -1;
+	}
+
+	if (s.count > 0)
+		qsort(s.buf, s.count, sizeof(*s.buf), fs_watch_file_cmp);
+	*snap  = s.buf;
+	*count = s.count;
+	return 0;
+}
+
+/* Diff a fresh scan against the last one, both are sorted so a single merge pass does it */
+static int fs_watch_poll(fs_watch_t *w) {
+	fs_watch_file_t *snap;
+	size_t           count;
+	if (fs_watch_scan(w, &snap, &count) != 0)
+		return -1;
+
+	size_t i = 0, j = 0;
+	while (i < w->_snap_count || j < count) {
+		int cmp = i >= w->_snap_count? 1 : j >= count? -1 :
+		          strcmp(w->_snap[i].path, snap[j].path);
+
+		int ret = 0;
+		if (cmp < 0)
+			ret = fs_watch_change(w, FS_JOIN_PATH(w->_snap[i ++].path), FS_WATCH_REMOVED);
+		else if (cmp > 0)
+			ret = fs_watch_change(w, FS_JOIN_PATH(snap[j ++].path), FS_WATCH_CREATED);
+		else {
+			if (w->_snap[i].mtime != snap[j].mtime)
+				ret = fs_watch_change(w, FS_JOIN_PATH(snap[j].path), FS_WATCH_MODIFIED);
+
+			++ i;
+			++ j;
+		}
+
+		if (ret != 0) {
+			fs_watch_snap_free(snap, count);
+			return -1;
+		}
+	}
+
+	fs_watch_snap_free(w->_snap, w->_snap_count);
+	w->_snap       = snap;
+	w->_snap_count = count;
+	return 0;
+}
+
+static int fs_watch_start_polling(fs_watch_t *w) {
+	w->_polling = true;
+
+#ifdef __linux__
+	if (w->_fd >= 0) {
+		close(w->_fd);
+		w->_fd = -1;
+	}
+
+	for (size_t i = 0; i < w->_wds_count; ++ i)
+		free(w->_wds[i].path);
+
+	w->_wds_count = 0;
+#endif
+
+	fs_watch_snap_free(w->_snap, w->_snap_count);
+	w->_snap       = NULL;
+	w->_snap_count = 0;
+	return fs_watch_scan(w, &w->_snap, &w->_snap_count);
+}
+
+int fs_watch_open(fs_watch_t *w, size_t debounce_ms) {
+	memset(w, 0, sizeof(*w));
+	w->_debounce_ms = debounce_ms;
+
+#ifdef __linux__
+	w->_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (w->_fd < 0)
+		w->_polling = true;
+#else
+	w->_fd      = -1;
+	w->_polling = true;
+#endif
+
+	return 0;
+}
+
+void fs_watch_close(fs_watch_t *w) {
+#ifdef __linux__
+	if (w->_fd >= 0)
+		close(w->_fd);
+#endif
+
+	for (size_t i = 0; i < w->_wds_count; ++ i)
+		free(w->_wds[i].path);
+
+	for (size_t i = 0; i < w->_roots_count; ++ i)
+		free(w->_roots[i]);
+
+	fs_watch_clear(w);
+	fs_watch_snap_free(w->_snap, w->_snap_count);
+
+	free(w->_wds);
+	free(w->_roots);
+	free(w->_changes);
+	memset(w, 0, sizeof(*w));
+	w->_fd = -1;
+}
+
+#ifdef __linux__
+#	define FS_WATCH_MASK (IN_CREATE | IN_MOVED_TO | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | \
+                       IN_DELETE | IN_MOVED_FROM | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+static int fs_watch_add_dir(fs_watch_t *w, const char *path) {
+	int wd = inotify_add_watch(w->_fd, path, FS_WATCH_MASK);
+	if (wd < 0)
+		return errno == ENOSPC? 1 : -1;
+
+	/* Watching a directory twice gives back the same descriptor, and the directory may have
+	   been moved since, so its path is replaced */
+	size_t pos = w->_wds_count;
+	while (pos > 0 && w->_wds[pos - 1].wd >= wd) {
+		if (w->_wds[pos - 1].wd == wd) {
+			char *copy = FS_JOIN_PATH(path);
+			if (copy == NULL)
+				return -1;
+
+			free(w->_wds[pos - 1].path);
+			w->_wds[pos - 1].path = copy;
+			return 0;
+		}
+
+		-- pos;
+	}
+
+	if (w->_wds_count >= w->_wds_size) {
+		w->_wds_size = w->_wds_size == 0? 64 : w->_wds_size * 2;
+		void *ptr = realloc(w->_wds, w->_wds_size * sizeof(*w->_wds));
+		if (ptr == NULL)
+			return -1;
+
+		w->_wds = (fs_watch_wd_t*)ptr;
+	}
+
+	char *copy = FS_JOIN_PATH(path);
+	if (copy == NULL)
+		return -1;
+
+	memmove(w->_wds + pos + 1, w->_wds + pos, (w->_wds_count - pos) * sizeof(*w->_wds));
+	w->_wds[pos].wd   = wd;
+	w->_wds[pos].path = copy;
+	++ w->_wds_count;
+	return 0;
+}
+
+typedef struct {
+	fs_watch_t *w;
+	int         status;
+} fs_watch_adder_t;
+
+static int fs_watch_add_prune(const fs_walk_ent_t *e, void *data) {
+	fs_watch_adder_t *adder = (fs_watch_adder_t*)data;
+	if (!(e->attr & FS_DIR) || adder->status != 0)
+		return FS_WALK_SKIP;
+
+	adder->status = fs_watch_add_dir(adder->w, e->path);
+	return adder->status == 0? FS_WALK_CONTINUE : FS_WALK_SKIP;
+}
+
+static void fs_watch_add_batch(const fs_walk_ent_t *ents, size_t count, void *data) {
+	(void)ents;
+	(void)count;
+	(void)data;
+}
+
+static int fs_watch_add_tree(fs_watch_t *w, const char *path) {
+	fs_watch_adder_t adder = {w, fs_watch_add_dir(w, path)};
+
+	if (adder.status == 0) {
+		fs_walk_opts_t opts;
+		memset(&opts, 0, sizeof(opts));
+		opts.prune = fs_watch_add_prune;
+		opts.data  = &adder;
+
+		if (fs_walk(path, &opts, fs_watch_add_batch, NULL) != 0 && adder.status == 0)
+			adder.status = -1;
+	}
+
+	/* Out of watch descriptors, fall back to rescanning everything */
+	if (adder.status > 0)
+		return fs_watch_start_polling(w);
+
+	return adder.status;
+}
+
+static void fs_watch_remove_wd(fs_watch_t *w, size_t idx) {
+	free(w->_wds[idx].path);
+	memmove(w->_wds + idx, w->_wds + idx + 1, (w->_wds_count - idx - 1) * sizeof(*w->_wds));
+	-- w->_wds_count;
+}
+
+/* A directory moved away keeps its watches, along with the paths they had before. They are
+   removed, and if the directory was moved inside the tree, it is watched again under its new
+   path. Events still queued for the old descriptors are then ignored */
+static void fs_watch_remove_tree(fs_watch_t *w, const char *path) {
+	size_t len = strlen(path);
+	for (size_t i = w->_wds_count; i -- > 0;) {
+		const char *it = w->_wds[i].path;
+		if (strncmp(it, path, len) == 0 && (it[len] == '\0' || it[len] == '/')) {
+			inotify_rm_watch(w->_fd, w->_wds[i].wd);
+			fs_watch_remove_wd(w, i);
+		}
+	}
+}
+
+static const char *fs_watch_wd_path(fs_watch_t *w, int wd, size_t *idx) {
+	size_t lo = 0, hi = w->_wds_count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (w->_wds[mid].wd == wd) {
+			if (idx != NULL)
+				*idx = mid;
+
+			return w->_wds[mid].path;
+		} else if (w->_wds[mid].wd < wd)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return NULL;
+}
+
+/* Returns 1 if there were any events */
+static int fs_watch_read(fs_watch_t *w) {
+	/* The union keeps the buffer aligned for the events */
+	union {
+		struct inotify_event e;
+		char                 buf[16 * 1024];
+	} u;
+
+	char   *buf = u.buf;
+	int     got = 0;
+	ssize_t n;
+
+	while ((n = read(w->_fd, buf, sizeof(u.buf))) > 0) {
+		got = 1;
+
+		for (char *it = buf; it < buf + n;) {
+			struct inotify_event *e = (struct inotify_event*)it;
+			it += sizeof(*e) + e->len;
+
+			if (e->mask & IN_Q_OVERFLOW) {
+				for (size_t i = 0; i < w->_roots_count; ++ i) {
+					if (fs_watch_change(w, FS_JOIN_PATH(w->_roots[i]), FS_WATCH_RESCAN) != 0)
+						return -1;
+				}
+
+				continue;
+			}
+
+			size_t      idx;
+			const char *dir = fs_watch_wd_path(w, e->wd, &idx);
+			if (dir == NULL)
+				continue;
+
+			if (e->mask & (IN_IGNORED | IN_DELETE_SELF)) {
+				fs_watch_remove_wd(w, idx);
+				continue;
+			}
+
+			/* Only a root gets here, the directories inside are removed when they are moved
+			   out of their parent */
+			if (e->mask & IN_MOVE_SELF) {
+				char *root = FS_JOIN_PATH(dir);
+				if (root == NULL)
+					return -1;
+
+				fs_watch_remove_tree(w, root);
+				free(root);
+				continue;
+			}
+
+			if (e->len == 0 || (e->name[0] == '.'))
+				continue;
+
+			int events = 0;
+			if (e->mask & (IN_CREATE | IN_MOVED_TO))
+				events |= FS_WATCH_CREATED;
+			if (e->mask & (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB))
+				events |= FS_WATCH_MODIFIED;
+			if (e->mask & (IN_DELETE | IN_MOVED_FROM))
+				events |= FS_WATCH_REMOVED;
+
+			char *path = FS_JOIN_PATH(dir, e->name);
+			if (path == NULL)
+				return -1;
+
+			if (e->mask & IN_ISDIR && e->mask & IN_MOVED_FROM)
+				fs_watch_remove_tree(w, path);
+
+			/* New directories have to be watched too, along with anything already inside */
+			if (e->mask & IN_ISDIR && events & FS_WATCH_CREATED) {
+				if (fs_watch_add_tree(w, path) != 0) {
+					free(path);
+					return -1;
+				}
+			}
+
+			if (fs_watch_change(w, path, events) != 0)
+				return -1;
+
+			if (w->_polling)
+				return 1;
+		}
+	}
+
+	if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		return -1;
+
+	return got;
+}
+#endif
+
+int fs_watch_add(fs_watch_t *w, const char *path) {
+	void *ptr = realloc(w->_roots, (w->_roots_count + 1) * sizeof(*w->_roots));
+	if (ptr == NULL)
+		return -1;
+
+	w->_roots = (char**)ptr;
+	w->_roots[w->_roots_count] = FS_JOIN_PATH(path);
+	if (w->_roots[w->_roots_count] == NULL)
+		return -1;
+
+	++ w->_roots_count;
+
+#ifdef __linux__
+	if (!w->_polling)
+		return fs_watch_add_tree(w, path);
+#endif
+
+	return fs_watch_start_polling(w);
+}
+
+int fs_watch_wait(fs_watch_t *w, int timeout_ms, const fs_change_t **changes, size_t *count) {
+	fs_watch_clear(w);
+	*changes = NULL;
+	*count   = 0;
+
+#ifdef __linux__
+	int64_t deadline = -1;
+#endif
+
+	for (int waited = 0; timeout_ms < 0 || waited <= timeout_ms;) {
+		if (w->_polling) {
+			if (fs_watch_poll(w) != 0)
+				return -1;
+
+			if (w->_changes_count > 0)
+				break;
+
+			int ms = FS_WATCH_POLL_MS;
+			if (timeout_ms >= 0 && timeout_ms - waited < ms)
+				ms = timeout_ms - waited;
+
+			if (ms <= 0)
+				break;
+
+			fs_watch_sleep(ms);
+			waited += ms;
+			continue;
+		}
+
+#ifdef __linux__
+		/* Events that are filtered out do not end the wait, so only what is left of the timeout
+		   is waited for */
+		int left = -1;
+		if (timeout_ms >= 0) {
+			int64_t now = fs_watch_now_ms();
+			if (deadline < 0)
+				deadline = now + timeout_ms;
+
+			left = now >= deadline? 0 : (int)(deadline - now);
+		}
+
+		struct pollfd p = {w->_fd, POLLIN, 0};
+		int ready = poll(&p, 1, left);
+		if (ready < 0 && errno != EINTR)
+			return -1;
+		else if (ready == 0)
+			break;
+
+		if (fs_watch_read(w) < 0)
+			return -1;
+
+		/* Keep collecting until things calm down, editors tend to touch a file several times
+		   on a single save */
+		while (!w->_polling && w->_debounce_ms > 0) {
+			ready = poll(&p, 1, (int)w->_debounce_ms);
+			if (ready < 0 && errno != EINTR)
+				return -1;
+			else if (ready == 0)
+				break;
+
+			if (fs_watch_read(w) < 0)
+				return -1;
+		}
+
+		if (w->_changes_count > 0)
+			break;
+#endif
+	}
+
+	if (w->_polling && w->_changes_count > 0 && w->_debounce_ms > 0) {
+		fs_watch_sleep((int)w->_debounce_ms);
+		if (fs_watch_poll(w) != 0)
+			return -1;
+	}
+
+	*changes = w->_changes;
+	*count   = w->_changes_count;
 	return 0;
 }
 
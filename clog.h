@@ -8,18 +8,25 @@
 #ifndef CLOG_H_HEADER_GUARD
 #define CLOG_H_HEADER_GUARD
 
+/* clock_gettime, localtime_r and fileno are POSIX, which strict modes like -std=c99 hide */
+#if defined(CLOG_IMPLEMENTATION) && defined(__STRICT_ANSI__) && !defined(_POSIX_C_SOURCE)
+#	define _POSIX_C_SOURCE 200809L
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 #include <stdio.h>   /* FILE, fprintf, stderr */
 #include <stdlib.h>  /* exit, EXIT_FAILURE */
-#include <time.h>    /* time_t, time, localtime */
+#include <time.h>    /* time_t, time, localtime_r, clock_gettime */
 #include <stdarg.h>  /* va_list, va_start, va_end, vsnprintf */
 #include <stdbool.h> /* bool, true, false */
+#include <string.h>  /* memcpy, memset */
+#include <stdint.h>  /* uint64_t */
 
 #define CLOG_VERSION_MAJOR 1
-#define CLOG_VERSION_MINOR 2
+#define CLOG_VERSION_MINOR 6
 #define CLOG_VERSION_PATCH 0
 
 #ifndef WIN32
@@ -30,24 +37,99 @@ extern "C" {
 
 #ifdef WIN32
 #	include <windows.h>
+#else
+#	include <unistd.h>  /* ssize_t */
+#	include <stddef.h>  /* ptrdiff_t */
+#	include <sched.h>   /* sched_yield */
+#	include <pthread.h> /* pthread_t, pthread_create, pthread_join, pthread_mutex_t, pthread_cond_t */
+#	include <sys/uio.h> /* writev, struct iovec */
+
+/* The ring buffer needs atomics that work in both C and C++ */
+#	if defined(__GNUC__) || defined(__clang__)
+#		define CLOG_HAVE_ASYNC
+#	endif
 #endif
 
 enum {
-	LOG_NONE = 0,
-	LOG_TIME = 1 << 0,
-	LOG_LOC  = 1 << 1,
+	LOG_NONE    = 0,
+	LOG_TIME    = 1 << 0,
+	LOG_LOC     = 1 << 1,
+	LOG_ELAPSED = 1 << 2, /* Monotonic time since the flag was first set, like "+12.345s" */
+};
+
+/* Macros and not an enum, so CLOG_MIN_LEVEL can be compared in #if */
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO  1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_FATAL 4
+
+/* Log calls below this level compile to nothing. LOG_FATAL is never filtered, it exits */
+#ifndef CLOG_MIN_LEVEL
+#	define CLOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+enum {
+	LOG_TEXT = 0,
+	LOG_JSON, /* One JSON object per line, for tools that parse the logs */
+};
+
+enum {
+	LOG_FIELD_STR = 0,
+	LOG_FIELD_INT,
+	LOG_FIELD_FLOAT,
+	LOG_FIELD_STRS, /* NULL terminated list, like argv */
 };
 
+/* Extra keys of a JSON record, see log_fields */
+typedef struct {
+	const char *key;
+	int         type;
+
+	const char  *str;
+	const char **strs;
+	long long    num;
+	double       flt;
+} log_field_t;
+
+log_field_t log_field_str(  const char *key, const char *str);
+log_field_t log_field_int(  const char *key, long long num);
+log_field_t log_field_float(const char *key, double flt);
+log_field_t log_field_strs( const char *key, const char **strs);
+
 void log_into(FILE *file);
 void log_set_flags(int flags);
-
-#define LOG_INFO( ...) log_info( __FILE__, __LINE__, __VA_ARGS__)
-#define LOG_WARN( ...) log_warn( __FILE__, __LINE__, __VA_ARGS__)
-#define LOG_ERROR(...) log_error(__FILE__, __LINE__, __VA_ARGS__)
+void log_set_format(int format);
+void log_set_level(int level); /* Lower levels are not formatted, LOG_LEVEL_INFO by default */
+
+extern int _log_level;
+
+/* Lines get queued for a writer thread instead of being written by the thread that logs them,
+   so logging from many threads never waits on the output. Without CLOG_HAVE_ASYNC logging stays
+   synchronous. Returns 0 on success */
+int  log_async_start(void);
+void log_async_stop(void); /* Writes out the queued lines, also done at exit */
+
+/* Filtered calls do not evaluate their arguments. The compiled out ones still type check them,
+   and count as uses of the variables they name */
+#define LOG_IF(LEVEL, CALL) \
+	((LEVEL) >= CLOG_MIN_LEVEL && (LEVEL) >= _log_level? CALL : (void)0)
+
+#define LOG_DEBUG(...) LOG_IF(LOG_LEVEL_DEBUG, log_debug(__FILE__, __LINE__, __VA_ARGS__))
+#define LOG_INFO( ...) LOG_IF(LOG_LEVEL_INFO,  log_info( __FILE__, __LINE__, __VA_ARGS__))
+#define LOG_WARN( ...) LOG_IF(LOG_LEVEL_WARN,  log_warn( __FILE__, __LINE__, __VA_ARGS__))
+#define LOG_ERROR(...) LOG_IF(LOG_LEVEL_ERROR, log_error(__FILE__, __LINE__, __VA_ARGS__))
 #define LOG_FATAL(...) log_fatal(__FILE__, __LINE__, __VA_ARGS__)
 
-#define LOG_CUSTOM(TITLE, ...) log_custom(TITLE, __FILE__, __LINE__, __VA_ARGS__)
+#define LOG_CUSTOM(TITLE, ...) \
+	LOG_IF(LOG_LEVEL_INFO, log_custom(TITLE, __FILE__, __LINE__, __VA_ARGS__))
 
+#define LOG_FIELDS(LEVEL, TITLE, FIELDS, FIELDS_COUNT, ...) \
+	((LEVEL) == LOG_LEVEL_FATAL? \
+	 log_fields(LEVEL, TITLE, FIELDS, FIELDS_COUNT, __FILE__, __LINE__, __VA_ARGS__) : \
+	 LOG_IF(LEVEL, log_fields(LEVEL, TITLE, FIELDS, FIELDS_COUNT, __FILE__, __LINE__, __VA_ARGS__)))
+
+void log_debug(const char *path, size_t line, const char *fmt, ...);
 void log_info( const char *path, size_t line, const char *fmt, ...);
 void log_warn( const char *path, size_t line, const char *fmt, ...);
 void log_error(const char *path, size_t line, const char *fmt, ...);
@@ -55,6 +137,11 @@ void log_fatal(const char *path, size_t line, const char *fmt, ...);
 
 void log_custom(const char *title, const char *path, size_t line, const char *fmt, ...);
 
+/* The fields only show up in the JSON format. A NULL fmt makes a record that only shows up in the
+   JSON format too, and a NULL title uses the level name. LOG_LEVEL_FATAL exits */
+void log_fields(int level, const char *title, const log_field_t *fields, size_t fields_count,
+                const char *path, size_t line, const char *fmt, ...);
+
 #ifdef __cplusplus
 }
 #endif
@@ -67,13 +154,6 @@ void log_custom(const char *title, const char *path, size_t line, const char *fm
 extern "C" {
 #endif
 
-enum {
-	CLOG_COLOR_INFO = 0,
-	CLOG_COLOR_WARN,
-	CLOG_COLOR_ERROR,
-	CLOG_COLOR_FATAL,
-};
-
 #ifdef WIN32
 #	define CLOG_RESET_COLOR      _log_color_default
 #	define CLOG_TIME_COLOR       FOREGROUND_INTENSITY
@@ -83,10 +163,11 @@ enum {
 static WORD _log_color_default = CLOG_MSG_COLOR;
 
 static WORD _log_colors[] = {
-	[CLOG_COLOR_INFO]  = FOREGROUND_GREEN | FOREGROUND_BLUE | FOREGROUND_INTENSITY,
-	[CLOG_COLOR_WARN]  = FOREGROUND_GREEN | FOREGROUND_RED  | FOREGROUND_INTENSITY,
-	[CLOG_COLOR_ERROR] = FOREGROUND_RED   | FOREGROUND_INTENSITY,
-	[CLOG_COLOR_FATAL] = FOREGROUND_RED   | FOREGROUND_BLUE | FOREGROUND_INTENSITY,
+	[LOG_LEVEL_DEBUG] = FOREGROUND_BLUE  | FOREGROUND_INTENSITY,
+	[LOG_LEVEL_INFO]  = FOREGROUND_GREEN | FOREGROUND_BLUE | FOREGROUND_INTENSITY,
+	[LOG_LEVEL_WARN]  = FOREGROUND_GREEN | FOREGROUND_RED  | FOREGROUND_INTENSITY,
+	[LOG_LEVEL_ERROR] = FOREGROUND_RED   | FOREGROUND_INTENSITY,
+	[LOG_LEVEL_FATAL] = FOREGROUND_RED   | FOREGROUND_BLUE | FOREGROUND_INTENSITY,
 };
 #else
 #	define CLOG_RESET_COLOR     "\x1b[0m"
@@ -95,17 +176,153 @@ static WORD _log_colors[] = {
 #	define CLOG_MSG_COLOR       "\x1b[0m"
 
 static const char *_log_colors[] = {
-	[CLOG_COLOR_INFO]  = "\x1b[1;96m",
-	[CLOG_COLOR_WARN]  = "\x1b[1;93m",
-	[CLOG_COLOR_ERROR] = "\x1b[1;91m",
-	[CLOG_COLOR_FATAL] = "\x1b[1;95m",
+	[LOG_LEVEL_DEBUG] = "\x1b[1;94m",
+	[LOG_LEVEL_INFO]  = "\x1b[1;96m",
+	[LOG_LEVEL_WARN]  = "\x1b[1;93m",
+	[LOG_LEVEL_ERROR] = "\x1b[1;91m",
+	[LOG_LEVEL_FATAL] = "\x1b[1;95m",
 };
 #endif
 
-static FILE *_log_file  = NULL;
-static int   _log_flags = LOG_NONE;
+/* Whole lines are composed in one buffer and written at once, so lines from different threads
+   do not tear */
+#define CLOG_LINE_SIZE 1024
+
+#ifdef CLOG_HAVE_ASYNC
+#	define CLOG_RING_SIZE  1024 /* Has to be a power of two */
+#	define CLOG_BATCH_SIZE 64   /* Lines per writev call */
+#	define CLOG_CACHE_LINE 64
+#endif
+
+/* Formatted into the stack buffer first, and only moved to the heap for longer lines */
+typedef struct {
+	char  *buf;
+	size_t len, cap;
+	bool   cut; /* Set if the heap could not be used, and the line got cut off */
+	char   stack[CLOG_LINE_SIZE];
+} log_line_t;
+
+static void log_line_init(log_line_t *l) {
+	l->buf      = l->stack;
+	l->len      = 0;
+	l->cap      = sizeof(l->stack);
+	l->cut      = false;
+	l->stack[0] = '\0';
+}
+
+static void log_line_free(log_line_t *l) {
+	if (l->buf != l->stack)
+		free(l->buf);
+}
+
+static void log_line_vadd(log_line_t *l, const char *fmt, va_list args) {
+	va_list copy;
+	va_copy(copy, args);
+	int len = vsnprintf(l->buf + l->len, l->cap - l->len, fmt, copy);
+	va_end(copy);
+
+	if (len < 0 || l->cut)
+		return;
+
+	if ((size_t)len >= l->cap - l->len) {
+		size_t cap = l->cap * 2;
+		while (cap <= l->len + (size_t)len)
+			cap *= 2;
+
+		char *buf = (char*)malloc(cap);
+		if (buf == NULL) {
+			l->len = l->cap - 1;
+			l->cut = true;
+			return;
+		}
+
+		memcpy(buf, l->buf, l->len);
+		log_line_free(l);
+		l->buf = buf;
+		l->cap = cap;
+
+		vsnprintf(l->buf + l->len, l->cap - l->len, fmt, args);
+	}
+
+	l->len += len;
+}
+
+static void log_line_add(log_line_t *l, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	log_line_vadd(l, fmt, args);
+	va_end(args);
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#	define CLOG_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#	define CLOG_THREAD_LOCAL __declspec(thread)
+#else
+#	define CLOG_THREAD_LOCAL
+#endif
+
+/* The clock only goes through the time zone rules once a second, and each thread keeps its own
+   copy so the cache needs no lock */
+static const char *log_time_str(void) {
+	static CLOG_THREAD_LOCAL time_t cached_sec = -1;
+	static CLOG_THREAD_LOCAL char   cached[16];
+
+	time_t raw = time(NULL);
+	if (raw != cached_sec) {
+		struct tm info;
+#ifdef WIN32
+		localtime_s(&info, &raw);
+#else
+		localtime_r(&raw, &info);
+#endif
+		snprintf(cached, sizeof(cached), "%d:%d:%d", info.tm_hour, info.tm_min, info.tm_sec);
+		cached_sec = raw;
+	}
+
+	return cached;
+}
+
+static uint64_t log_now_ns(void) {
+#ifdef WIN32
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (uint64_t)count.QuadPart / freq.QuadPart * 1000000000 +
+	       (uint64_t)count.QuadPart % freq.QuadPart * 1000000000 / freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static uint64_t _log_start_ns = 0;
+
+static void log_line_elapsed(log_line_t *l) {
+	uint64_t ms = (log_now_ns() - _log_start_ns) / 1000000;
+	log_line_add(l, "+%llu.%03us", (unsigned long long)(ms / 1000), (unsigned)(ms % 1000));
+}
+
+static const char *_log_levels[] = {
+	[LOG_LEVEL_DEBUG] = "DEBUG",
+	[LOG_LEVEL_INFO]  = "INFO",
+	[LOG_LEVEL_WARN]  = "WARN",
+	[LOG_LEVEL_ERROR] = "ERROR",
+	[LOG_LEVEL_FATAL] = "FATAL",
+};
+
+static FILE *_log_file   = NULL;
+static int   _log_flags  = LOG_NONE;
+static int   _log_format = LOG_TEXT;
+
+int _log_level = LOG_LEVEL_INFO;
 
 void log_set_flags(int flags) {
+	/* Elapsed time counts from when it was first asked for */
+	if (flags & LOG_ELAPSED && _log_start_ns == 0)
+		_log_start_ns = log_now_ns();
+
 	_log_flags = flags;
 }
 
@@ -113,140 +330,570 @@ void log_into(FILE *file) {
 	_log_file = file;
 }
 
+void log_set_format(int format) {
+	_log_format = format;
+}
+
+void log_set_level(int level) {
+	_log_level = level;
+}
+
+static log_field_t log_field(const char *key, int type) {
+	log_field_t f;
+	memset(&f, 0, sizeof(f));
+	f.key  = key;
+	f.type = type;
+	return f;
+}
+
+log_field_t log_field_str(const char *key, const char *str) {
+	log_field_t f = log_field(key, LOG_FIELD_STR);
+	f.str = str;
+	return f;
+}
+
+log_field_t log_field_int(const char *key, long long num) {
+	log_field_t f = log_field(key, LOG_FIELD_INT);
+	f.num = num;
+	return f;
+}
+
+log_field_t log_field_float(const char *key, double flt) {
+	log_field_t f = log_field(key, LOG_FIELD_FLOAT);
+	f.flt = flt;
+	return f;
+}
+
+log_field_t log_field_strs(const char *key, const char **strs) {
+	log_field_t f = log_field(key, LOG_FIELD_STRS);
+	f.strs = strs;
+	return f;
+}
+
+#ifdef CLOG_HAVE_ASYNC
+typedef struct {
+	size_t seq; /* Equal to the position when free, and one past it when holding a line */
+	FILE  *file;
+	char  *heap; /* Lines too long for buf are handed over, and freed after being written */
+	size_t len;
+	char   buf[CLOG_LINE_SIZE];
+} log_slot_t;
+
+/* Bounded multi producer, single consumer queue. Producers claim a position with a compare and
+   swap on the tail, and publish the slot through its sequence number, so they never take a lock
+   unless the writer is asleep. Only a full ring makes them wait */
+static struct {
+	log_slot_t     *slots;
+	bool            running, stop, sleeping;
+	size_t          pushing; /* Producers that may still touch the ring */
+	pthread_t       thread;
+	pthread_mutex_t lock;
+	pthread_cond_t  wake;
+
+	/* Kept on separate cache lines, the producers and the writer would slow each other down */
+	char   pad_tail[CLOG_CACHE_LINE];
+	size_t tail;
+	char   pad_head[CLOG_CACHE_LINE - sizeof(size_t)];
+	size_t head;
+	char   pad_end[CLOG_CACHE_LINE - sizeof(size_t)];
+} _log_async;
+
+static bool log_async_ready(void) {
+	log_slot_t *slot = &_log_async.slots[_log_async.head & (CLOG_RING_SIZE - 1)];
+	return __atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) == _log_async.head + 1;
+}
+
+static void log_async_wake(void) {
+	pthread_mutex_lock(&_log_async.lock);
+	pthread_cond_signal(&_log_async.wake);
+	pthread_mutex_unlock(&_log_async.lock);
+}
+
+static void log_async_write(FILE *file, struct iovec *iov, int count) {
+	/* Anything written through stdio before has to come out first */
+	fflush(file);
+
+	int fd = fileno(file);
+	while (count > 0) {
+		ssize_t written = writev(fd, iov, count);
+		if (written < 0)
+			return;
+
+		for (; count > 0 && (size_t)written >= iov->iov_len; ++ iov, -- count)
+			written -= iov->iov_len;
+
+		if (count > 0) {
+			iov->iov_base  = (char*)iov->iov_base + written;
+			iov->iov_len  -= written;
+		}
+	}
+}
+
+static void *log_async_writer(void *data) {
+	(void)data;
+
+	struct iovec iov[CLOG_BATCH_SIZE];
+	for (;;) {
+		if (!log_async_ready()) {
+			pthread_mutex_lock(&_log_async.lock);
+			__atomic_store_n(&_log_async.sleeping, true, __ATOMIC_SEQ_CST);
+
+			bool stop = false;
+			while (!log_async_ready() && !(stop = _log_async.stop))
+				pthread_cond_wait(&_log_async.wake, &_log_async.lock);
+
+			__atomic_store_n(&_log_async.sleeping, false, __ATOMIC_SEQ_CST);
+			pthread_mutex_unlock(&_log_async.lock);
+
+			if (stop)
+				break;
+		}
+
+		/* Batch the ready lines that go into the same file */
+		size_t head  = _log_async.head;
+		FILE  *file  = _log_async.slots[head & (CLOG_RING_SIZE - 1)].file;
+		int    count = 0;
+		for (; count < CLOG_BATCH_SIZE; ++ count, ++ _log_async.head) {
+			log_slot_t *slot = &_log_async.slots[_log_async.head & (CLOG_RING_SIZE - 1)];
+			if (!log_async_ready() || slot->file != file)
+				break;
+
+			iov[count].iov_base = slot->heap != NULL? slot->heap : slot->buf;
+			iov[count].iov_len  = slot->len;
+		}
+
+		log_async_write(file, iov, count);
+
+		for (; head != _log_async.head; ++ head) {
+			log_slot_t *slot = &_log_async.slots[head & (CLOG_RING_SIZE - 1)];
+			free(slot->heap);
+			__atomic_store_n(&slot->seq, head + CLOG_RING_SIZE, __ATOMIC_SEQ_CST);
+		}
+	}
+
+	return NULL;
+}
+
+static void log_async_push(FILE *file, log_line_t *l) {
+	size_t      pos = __atomic_load_n(&_log_async.tail, __ATOMIC_RELAXED);
+	log_slot_t *slot;
+	for (;;) {
+		slot = &_log_async.slots[pos & (CLOG_RING_SIZE - 1)];
+
+		size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq == pos) {
+			if (__atomic_compare_exchange_n(&_log_async.tail, &pos, pos + 1, true,
+			                                __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else {
+			/* The ring is full when the slot still holds the line from a lap ago */
+			if ((ptrdiff_t)(seq - pos) < 0)
+				sched_yield();
+
+			pos = __atomic_load_n(&_log_async.tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	if (l->buf == l->stack) {
+		memcpy(slot->buf, l->buf, l->len);
+		slot->heap = NULL;
+	} else {
+		slot->heap = l->buf;
+		l->buf     = l->stack;
+	}
+
+	slot->file = file;
+	slot->len  = l->len;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&_log_async.sleeping, __ATOMIC_SEQ_CST))
+		log_async_wake();
+}
+
+/* A forked child does not have the writer thread, so it writes synchronously. The lines queued
+   before the fork are left to the parent */
+static void log_async_forked(void) {
+	_log_async.running = false;
+	_log_async.pushing = 0;
+}
+
+int log_async_start(void) {
+	if (_log_async.running)
+		return 0;
+
+	_log_async.slots = (log_slot_t*)malloc(CLOG_RING_SIZE * sizeof(*_log_async.slots));
+	if (_log_async.slots == NULL)
+		return -1;
+
+	for (size_t i = 0; i < CLOG_RING_SIZE; ++ i)
+		_log_async.slots[i].seq = i;
+
+	_log_async.tail     = 0;
+	_log_async.head     = 0;
+	_log_async.stop     = false;
+	_log_async.sleeping = false;
+
+	pthread_mutex_init(&_log_async.lock, NULL);
+	pthread_cond_init(&_log_async.wake, NULL);
+
+	if (pthread_create(&_log_async.thread, NULL, log_async_writer, NULL) != 0) {
+		pthread_mutex_destroy(&_log_async.lock);
+		pthread_cond_destroy(&_log_async.wake);
+		free(_log_async.slots);
+		return -1;
+	}
+
+	static bool registered = false;
+	if (!registered) {
+		atexit(log_async_stop);
+		pthread_atfork(NULL, NULL, log_async_forked);
+		registered = true;
+	}
+
+	__atomic_store_n(&_log_async.running, true, __ATOMIC_SEQ_CST);
+	return 0;
+}
+
+/* Other threads may keep logging, also when called at exit. Once it returns they write
+   synchronously */
+void log_async_stop(void) {
+	if (!_log_async.running)
+		return;
+
+	/* Producers count themselves before looking at running, so after this every one of them
+	   either sees it stopped or is counted, and the ring is only freed once those are done */
+	__atomic_store_n(&_log_async.running, false, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&_log_async.pushing, __ATOMIC_SEQ_CST) > 0)
+		sched_yield();
+
+	pthread_mutex_lock(&_log_async.lock);
+	_log_async.stop = true;
+	pthread_cond_signal(&_log_async.wake);
+	pthread_mutex_unlock(&_log_async.lock);
+
+	pthread_join(_log_async.thread, NULL);
+
+	pthread_mutex_destroy(&_log_async.lock);
+	pthread_cond_destroy(&_log_async.wake);
+	free(_log_async.slots);
+	_log_async.slots = NULL;
+}
+#else
+int log_async_start(void) {
+	return -1;
+}
+
+void log_async_stop(void) {}
+#endif
+
+static void log_write(log_line_t *l) {
+	/* A cut off line still has to end the line */
+	if (l->cut)
+		l->buf[l->len - 1] = '\n';
+
+#ifdef CLOG_HAVE_ASYNC
+	__atomic_add_fetch(&_log_async.pushing, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&_log_async.running, __ATOMIC_SEQ_CST)) {
+		log_async_push(_log_file, l);
+		__atomic_sub_fetch(&_log_async.pushing, 1, __ATOMIC_SEQ_CST);
+		log_line_free(l);
+		return;
+	}
+
+	__atomic_sub_fetch(&_log_async.pushing, 1, __ATOMIC_SEQ_CST);
+#endif
+
+	fwrite(l->buf, 1, l->len, _log_file);
+	log_line_free(l);
+}
+
+#ifdef WIN32
 static void log_reset_color(void) {
 	if (_log_file != stderr && _log_file != stdout)
 		return;
 
-#ifdef WIN32
 	SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), CLOG_RESET_COLOR);
-#else
-	fprintf(_log_file, "%s", CLOG_RESET_COLOR);
-#endif
 }
 
 static void log_print_title(int color, const char *title) {
 	log_reset_color();
 
 	if (_log_file == stderr || _log_file == stdout)
-#ifdef WIN32
 		SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), _log_colors[color]);
-#else
-		fprintf(_log_file, "%s", _log_colors[color]);
-#endif
 
 	fprintf(_log_file, "[%s]", title);
 	log_reset_color();
 }
 
-static void log_print_time(void) {
-	time_t raw;
-	time(&raw);
-	struct tm *info = localtime(&raw);
-
+static void log_print_time(const char *str) {
 	if (_log_file == stderr || _log_file == stdout)
-#ifdef WIN32
 		SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), CLOG_TIME_COLOR);
-#else
-		fprintf(_log_file, "%s", CLOG_TIME_COLOR);
-#endif
 
-	fprintf(_log_file, "%d:%d:%d", info->tm_hour, info->tm_min, info->tm_sec);
+	fprintf(_log_file, "%s", str);
 	log_reset_color();
+	fprintf(_log_file, " ");
 }
 
 static void log_print_loc(const char *path, size_t line) {
-#ifdef WIN32
 	SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), CLOG_HIGHLIGHT_COLOR);
-#else
-	fprintf(_log_file, "%s", CLOG_HIGHLIGHT_COLOR);
-#endif
 	fprintf(_log_file, " %s:%zu:", path, line);
 	log_reset_color();
 }
 
 static void log_print_msg(const char *msg) {
-#ifdef WIN32
 	SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), CLOG_MSG_COLOR);
-#else
-	fprintf(_log_file, "%s", CLOG_MSG_COLOR);
-#endif
-
 	fprintf(_log_file, " %s\n", msg);
 	log_reset_color();
 }
 
-static void log_template(int color, const char *title, const char *msg,
-                         const char *path, size_t line) {
-	if (_log_file == NULL)
-		_log_file = stderr;
+/* Colors are set through the console between the writes, so the file stays locked for the whole
+   line instead */
+static void log_text(int color, const char *title, const char *path, size_t line,
+                     const char *fmt, va_list args) {
+	log_line_t msg;
+	log_line_init(&msg);
+	log_line_vadd(&msg, fmt, args);
+
+	log_line_t elapsed;
+	log_line_init(&elapsed);
+	if (_log_flags & LOG_ELAPSED)
+		log_line_elapsed(&elapsed);
+
+	_lock_file(_log_file);
 
-#ifdef WIN32
 	CONSOLE_SCREEN_BUFFER_INFO csbi;
 	GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi);
 	_log_color_default = csbi.wAttributes;
-#endif
 
-	if (_log_flags & LOG_TIME) {
-		log_print_time();
-		fprintf(_log_file, " ");
-	}
+	if (_log_flags & LOG_TIME)
+		log_print_time(log_time_str());
+
+	if (_log_flags & LOG_ELAPSED)
+		log_print_time(elapsed.buf);
+
 	log_print_title(color, title);
 
 	if (_log_flags & LOG_LOC)
 		log_print_loc(path, line);
 
-	log_print_msg(msg);
+	log_print_msg(msg.buf);
+
+	_unlock_file(_log_file);
+	log_line_free(&msg);
+	log_line_free(&elapsed);
 }
+#else
+static void log_text(int color, const char *title, const char *path, size_t line,
+                     const char *fmt, va_list args) {
+	bool        tty   = _log_file == stderr || _log_file == stdout;
+	const char *reset = tty? CLOG_RESET_COLOR : "";
 
-void log_info(const char *path, size_t line, const char *fmt, ...) {
-	char    buf[256];
+	log_line_t l;
+	log_line_init(&l);
+
+	if (_log_flags & LOG_TIME)
+		log_line_add(&l, "%s%s%s ", tty? CLOG_TIME_COLOR : "", log_time_str(), reset);
+
+	if (_log_flags & LOG_ELAPSED) {
+		log_line_add(&l, "%s", tty? CLOG_TIME_COLOR : "");
+		log_line_elapsed(&l);
+		log_line_add(&l, "%s ", reset);
+	}
+
+	log_line_add(&l, "%s%s[%s]%s", reset, tty? _log_colors[color] : "", title, reset);
+
+	if (_log_flags & LOG_LOC)
+		log_line_add(&l, CLOG_HIGHLIGHT_COLOR " %s:%zu:%s", path, line, reset);
+
+	log_line_add(&l, CLOG_MSG_COLOR " ");
+	log_line_vadd(&l, fmt, args);
+	log_line_add(&l, "\n%s", reset);
+
+	log_write(&l);
+}
+#endif
+
+static void log_json_str(log_line_t *l, const char *str) {
+	log_line_add(l, "\"");
+	for (const char *it = str; *it != '\0';) {
+		/* Copy the runs that need no escaping at once */
+		size_t run = 0;
+		while (it[run] != '\0' && (unsigned char)it[run] >= ' ' && it[run] != '"' && it[run] != '\\')
+			++ run;
+
+		if (run > 0) {
+			log_line_add(l, "%.*s", (int)run, it);
+			it += run;
+			continue;
+		}
+
+		switch (*it) {
+		case '"':  log_line_add(l, "\\\""); break;
+		case '\\': log_line_add(l, "\\\\"); break;
+		case '\n': log_line_add(l, "\\n");  break;
+		case '\t': log_line_add(l, "\\t");  break;
+		case '\r': log_line_add(l, "\\r");  break;
+
+		default: log_line_add(l, "\\u%04x", (unsigned char)*it);
+		}
+
+		++ it;
+	}
+	log_line_add(l, "\"");
+}
+
+static double log_wall_time(void) {
+#ifdef WIN32
+	/* 100 nanosecond intervals since 1601 */
+	FILETIME ft;
+	GetSystemTimeAsFileTime(&ft);
+	uint64_t t = (uint64_t)ft.dwHighDateTime << 32 | ft.dwLowDateTime;
+	return (double)(t - 116444736000000000ULL) / 1e7;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+static void log_json(int level, const char *title, const log_field_t *fields, size_t fields_count,
+                     const char *path, size_t line, const char *fmt, va_list args) {
+	log_line_t l;
+	log_line_init(&l);
+
+	log_line_add(&l, "{\"time\":%.3f", log_wall_time());
+	if (_log_flags & LOG_ELAPSED)
+		log_line_add(&l, ",\"elapsed\":%.3f", (double)(log_now_ns() - _log_start_ns) / 1e9);
+
+	log_line_add(&l, ",\"level\":\"%s\",\"title\":", _log_levels[level]);
+	log_json_str(&l, title);
+	log_line_add(&l, ",\"file\":");
+	log_json_str(&l, path);
+	log_line_add(&l, ",\"line\":%zu", line);
+
+	if (fmt != NULL) {
+		log_line_t msg;
+		log_line_init(&msg);
+		log_line_vadd(&msg, fmt, args);
+
+		log_line_add(&l, ",\"msg\":");
+		log_json_str(&l, msg.buf);
+		log_line_free(&msg);
+	}
+
+	for (size_t i = 0; i < fields_count; ++ i) {
+		const log_field_t *f = &fields[i];
+
+		log_line_add(&l, ",");
+		log_json_str(&l, f->key);
+		log_line_add(&l, ":");
+
+		switch (f->type) {
+		case LOG_FIELD_INT: log_line_add(&l, "%lld", f->num); break;
+
+		case LOG_FIELD_FLOAT:
+			/* JSON has no infinity or NaN */
+			if (f->flt - f->flt == 0)
+				log_line_add(&l, "%.9g", f->flt);
+			else
+				log_line_add(&l, "null");
+			break;
+
+		case LOG_FIELD_STRS:
+			log_line_add(&l, "[");
+			for (const char **it = f->strs; it != NULL && *it != NULL; ++ it) {
+				if (it != f->strs)
+					log_line_add(&l, ",");
+
+				log_json_str(&l, *it);
+			}
+			log_line_add(&l, "]");
+			break;
+
+		default:
+			if (f->str == NULL)
+				log_line_add(&l, "null");
+			else
+				log_json_str(&l, f->str);
+		}
+	}
+
+	log_line_add(&l, "}\n");
+	log_write(&l);
+}
+
+static void log_template(int level, const char *title, const log_field_t *fields,
+                         size_t fields_count, const char *path, size_t line,
+                         const char *fmt, va_list args) {
+	/* The functions can be called directly too, without the filtering macros */
+	if (level < _log_level && level != LOG_LEVEL_FATAL)
+		return;
+
+	if (_log_file == NULL)
+		_log_file = stderr;
+
+	if (title == NULL)
+		title = _log_levels[level];
+
+	if (_log_format == LOG_JSON)
+		log_json(level, title, fields, fields_count, path, line, fmt, args);
+	else if (fmt != NULL)
+		log_text(level, title, path, line, fmt, args);
+}
+
+void log_debug(const char *path, size_t line, const char *fmt, ...) {
 	va_list args;
 	va_start(args, fmt);
-	vsnprintf(buf, sizeof(buf), fmt, args);
+	log_template(LOG_LEVEL_DEBUG, NULL, NULL, 0, path, line, fmt, args);
 	va_end(args);
+}
 
-	log_template(CLOG_COLOR_INFO, "INFO", buf, path, line);
+void log_info(const char *path, size_t line, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	log_template(LOG_LEVEL_INFO, NULL, NULL, 0, path, line, fmt, args);
+	va_end(args);
 }
 
 void log_warn(const char *path, size_t line, const char *fmt, ...) {
-	char    buf[256];
 	va_list args;
 	va_start(args, fmt);
-	vsnprintf(buf, sizeof(buf), fmt, args);
+	log_template(LOG_LEVEL_WARN, NULL, NULL, 0, path, line, fmt, args);
 	va_end(args);
-
-	log_template(CLOG_COLOR_WARN, "WARN", buf, path, line);
 }
 
 void log_error(const char *path, size_t line, const char *fmt, ...) {
-	char    buf[256];
 	va_list args;
 	va_start(args, fmt);
-	vsnprintf(buf, sizeof(buf), fmt, args);
+	log_template(LOG_LEVEL_ERROR, NULL, NULL, 0, path, line, fmt, args);
 	va_end(args);
-
-	log_template(CLOG_COLOR_ERROR, "ERROR", buf, path, line);
 }
 
 void log_fatal(const char *path, size_t line, const char *fmt, ...) {
-	char    buf[256];
 	va_list args;
 	va_start(args, fmt);
-	vsnprintf(buf, sizeof(buf), fmt, args);
+	log_template(LOG_LEVEL_FATAL, NULL, NULL, 0, path, line, fmt, args);
 	va_end(args);
 
-	log_template(CLOG_COLOR_FATAL, "FATAL", buf, path, line);
 	exit(EXIT_FAILURE);
 }
 
 void log_custom(const char *title, const char *path, size_t line, const char *fmt, ...) {
-	char    buf[256];
 	va_list args;
 	va_start(args, fmt);
-	vsnprintf(buf, sizeof(buf), fmt, args);
+	log_template(LOG_LEVEL_INFO, title, NULL, 0, path, line, fmt, args);
+	va_end(args);
+}
+
+void log_fields(int level, const char *title, const log_field_t *fields, size_t fields_count,
+                const char *path, size_t line, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	log_template(level, title, fields, fields_count, path, line, fmt, args);
 	va_end(args);
 
-	log_template(CLOG_COLOR_INFO, title, buf, path, line);
+	if (level == LOG_LEVEL_FATAL)
+		exit(EXIT_FAILURE);
 }
 
 #ifdef __cplusplus
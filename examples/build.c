@@ -77,8 +77,9 @@ void build(void) {
 	size_t o_files_count = 0;
 
 	/* Build cache for optimized building */
-	build_cache_t c; /* Cache is stored in BUILD_CACHE_PATH, which is ".cbuilder-cache". Dont
-	                    forget to put this path into .gitignore if youre using git */
+	build_cache_t c; /* Cache is stored in BUILD_CACHE_PATH, which is ".cbuilder-cache", next to
+	                    its lock file ".cbuilder-cache.lock". Dont forget to put these paths
+	                    into .gitignore if youre using git */
 	if (build_cache_load(&c) != 0)
 		LOG_FATAL("Build cache is corrupted");
 